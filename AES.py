@@ -1,162 +1,129 @@
 import blockcipher
 
-import math
-
 block_size = 16
 encrypt = 0
 decrypt = 1
 
-def ecb( key_in, data, mode ):
-	key_l = list(key_in.to_bytes(16, byteorder='big'))
+key_sizes = (16, 24, 32)
 
-	if mode not in (encrypt, decrypt):
-		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
+# the block loops live in blockcipher; data may be any buffer or a sequence of ints
+def _as_buffer( data ):
+	try:
+		return memoryview(data)
+	except TypeError:
+		return bytes(data)
 
-	crypted = []
-	total_blocks = math.floor(len(data) / block_size)
-	iterator = 0
+# key_size picks AES-128, AES-192 or AES-256
+def _key( key_in, key_size ):
+	if key_size not in key_sizes:
+		raise ValueError('key_size MUST be 16, 24 or 32')
 
-	while iterator < total_blocks:
-		block = data[iterator*block_size : (iterator+1)*block_size]
-		crypted.extend(blockcipher.blockcipher(key_l, block, mode))
-		iterator += 1
+	return blockcipher.Key(key_in.to_bytes(key_size, byteorder='big'))
+
+def ecb( key_in, data, mode, key_size=16 ):
+	key = _key(key_in, key_size)
+
+	if mode not in (encrypt, decrypt):
+		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
 
-	return crypted
+	return list(blockcipher.ecb(key, _as_buffer(data), mode))
 
-def cbc( key_in, iv_in, data, mode ):
-	key_l = list(key_in.to_bytes(16, byteorder='big'))
-	iv_l = list(iv_in.to_bytes(16, byteorder='big'))
+def cbc( key_in, iv_in, data, mode, key_size=16 ):
+	key = _key(key_in, key_size)
+	iv = iv_in.to_bytes(16, byteorder='big')
 
 	if mode not in (encrypt, decrypt):
 		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
 
-	crypted = []
-	total_blocks = math.floor(len(data) / block_size)
-	iterator = 0
-	curr_iv = iv_l
+	return list(blockcipher.cbc(key, iv, _as_buffer(data), mode))
 
-	if mode == encrypt:
-		while iterator < total_blocks:
-			block = data[iterator*block_size : (iterator+1)*block_size]
-			xor = [a ^ b for a, b in zip(block, curr_iv)]
-			ciphertext = blockcipher.blockcipher(key_l, xor, mode)
-			crypted.extend(ciphertext)
-			curr_iv = ciphertext
-			iterator += 1
-	if mode == decrypt:
-		while iterator < total_blocks:
-			block = data[iterator*block_size : (iterator+1)*block_size]
-			ciphertext = blockcipher.blockcipher(key_l, block, mode)
-			xor = [a ^ b for a, b in zip(ciphertext, curr_iv)]
-			crypted.extend(xor)
-			curr_iv = block
-			iterator += 1
+def pcbc( key_in, iv_in, data, mode, key_size=16 ):
+	key = _key(key_in, key_size)
+	iv = iv_in.to_bytes(16, byteorder='big')
+
+	if mode not in (encrypt, decrypt):
+		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
 
-	return crypted
+	return list(blockcipher.pcbc(key, iv, _as_buffer(data), mode))
 
-def pcbc( key_in, iv_in, data, mode ):
-	key_l = list(key_in.to_bytes(16, byteorder='big'))
-	iv_l = list(iv_in.to_bytes(16, byteorder='big'))
+def cfb( key_in, iv_in, data, mode, key_size=16 ):
+	key = _key(key_in, key_size)
+	iv = iv_in.to_bytes(16, byteorder='big')
 
 	if mode not in (encrypt, decrypt):
 		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
 
-	crypted = []
-	total_blocks = math.floor(len(data) / block_size)
-	iterator = 0
-	curr_iv = iv_l
+	return list(blockcipher.cfb(key, iv, _as_buffer(data), mode))
 
-	if mode == encrypt:
-		while iterator < total_blocks:
-			block = data[iterator*block_size : (iterator+1)*block_size]
-			xor = [a ^ b for a, b in zip(block, curr_iv)]
-			ciphertext = blockcipher.blockcipher(key_l, xor, mode)
-			crypted.extend(ciphertext)
-			curr_iv = [a ^ b for a, b in zip(block, ciphertext)]
-			iterator += 1
+def ofb( key_in, iv_in, data, mode, key_size=16 ):
+	key = _key(key_in, key_size)
+	iv = iv_in.to_bytes(16, byteorder='big')
 
-	if mode == decrypt:
-		while iterator < total_blocks:
-			block = data[iterator*block_size : (iterator+1)*block_size]
-			ciphertext = blockcipher.blockcipher(key_l, block, mode)
-			xor = [a ^ b for a, b in zip(ciphertext, curr_iv)]
-			crypted.extend(xor)
-			curr_iv = [a ^ b for a, b in zip(block, xor)]
-			iterator += 1
+	if mode not in (encrypt, decrypt):
+		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
 
-	return crypted
+	return list(blockcipher.ofb(key, iv, _as_buffer(data), mode))
 
-def cfb( key_in, iv_in, data, mode ):
-	key_l = list(key_in.to_bytes(16, byteorder='big'))
-	iv_l = list(iv_in.to_bytes(16, byteorder='big'))
+def ctr( key_in, nonce_in, data, mode, key_size=16 ):
+	key = _key(key_in, key_size)
 
 	if mode not in (encrypt, decrypt):
 		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
 
-	crypted = []
-	total_blocks = math.floor(len(data) / block_size)
-	iterator = 0
-	curr_iv = iv_l
+	return list(blockcipher.ctr(key, nonce_in, _as_buffer(data), mode))
 
-	if mode == encrypt:
-		while iterator < total_blocks:
-			block = data[iterator*block_size : (iterator+1)*block_size]
-			ciphertext = blockcipher.blockcipher(key_l, curr_iv, encrypt)
-			curr_iv = [a ^ b for a, b in zip(block, ciphertext)]
-			crypted.extend(curr_iv)
-			iterator += 1
+# ofb or ctr keystream made ahead on a background thread; its crypt(data)
+# encrypts and decrypts alike, making keystream inline if the lookahead runs out
+def keystream( name, key_in, iv_in, lookahead=65536, key_size=16 ):
+	key = _key(key_in, key_size)
 
-	if mode == decrypt:
-		while iterator < total_blocks:
-			block = data[iterator*block_size : (iterator+1)*block_size]
-			ciphertext = blockcipher.blockcipher(key_l, curr_iv, encrypt)
-			xor = [a ^ b for a, b in zip(block, ciphertext)]
-			crypted.extend(xor)
-			curr_iv = block
-			iterator += 1
+	if name == 'ofb':
+		return blockcipher.OFBKeystream(key, iv_in.to_bytes(16, byteorder='big'), lookahead)
+	if name == 'ctr':
+		return blockcipher.CTRKeystream(key, iv_in, lookahead)
 
-	return crypted
+	raise ValueError('keystream is only for ofb and ctr')
 
-def ofb( key_in, iv_in, data, mode ):
-	key_l = list(key_in.to_bytes(16, byteorder='big'))
-	iv_l = list(iv_in.to_bytes(16, byteorder='big'))
+# many independent messages under one key in one call. messages is a list of
+# (iv_in, data) pairs, iv_in being the nonce for ctr and ignored for ecb
+def batch( name, key_in, messages, mode, key_size=16 ):
+	key = _key(key_in, key_size)
 
 	if mode not in (encrypt, decrypt):
 		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
 
-	crypted = []
-	total_blocks = math.floor(len(data) / block_size)
-	iterator = 0
-	curr_iv = iv_l
+	ivs = bytearray()
+	offsets = [0]
+	for iv_in, data in messages:
+		if name == 'ctr':
+			ivs += (iv_in & 0xffffffffffffffff).to_bytes(8, byteorder='big') + bytes(8)
+		elif name != 'ecb':
+			ivs += iv_in.to_bytes(16, byteorder='big')
+		offsets.append(offsets[-1] + len(data))
 
-	while iterator < total_blocks:
-		block = data[iterator*block_size : (iterator+1)*block_size]
-		ciphertext = blockcipher.blockcipher(key_l, curr_iv, encrypt)
-		xor = [a ^ b for a, b in zip(block, ciphertext)]
-		crypted.extend(xor)
-		curr_iv = ciphertext
-		iterator += 1
+	data = b''.join(bytes(_as_buffer(data)) for iv_in, data in messages)
+	out = blockcipher.batch(name, key, bytes(ivs), data, offsets, mode)
+	return [out[offsets[i]:offsets[i+1]] for i in range(len(messages))]
 
-	return crypted
+# plaintext of data[offset:offset+length] for ecb, cbc, cfb or ctr ciphertext,
+# decrypting only the blocks that cover it; iv_in is the nonce for ctr
+def decrypt_range( name, key_in, iv_in, data, offset, length, key_size=16 ):
+	key = _key(key_in, key_size)
 
-def ctr( key_in, nonce_in, data, mode ):
-	key_l = list(key_in.to_bytes(16, byteorder='big'))
+	if name == 'cbc' or name == 'cfb':
+		iv_in = iv_in.to_bytes(16, byteorder='big')
 
-	if mode not in (encrypt, decrypt):
-		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
+	return list(blockcipher.decrypt_range(name, key, iv_in, _as_buffer(data), offset, length))
+
+# XTS over whole sectors of sector_size bytes, numbered from first_sector;
+# key1_in encrypts the data and key2_in the sector tweaks
+def xts( key1_in, key2_in, data, sector_size, mode, first_sector=0, key_size=16 ):
+	key1 = _key(key1_in, key_size)
+	key2 = _key(key2_in, key_size)
+
+	if mode == encrypt:
+		return list(blockcipher.xts_encrypt(key1, key2, _as_buffer(data), sector_size, first_sector))
+	if mode == decrypt:
+		return list(blockcipher.xts_decrypt(key1, key2, _as_buffer(data), sector_size, first_sector))
 
-	crypted = []
-	total_blocks = math.floor(len(data) / block_size)
-	iterator = 0
-	nonce_ctr = (nonce_in & 0xffffffffffffffff) << 64
-
-	while iterator < total_blocks:
-		nonce_ctr_l = list(nonce_ctr.to_bytes(16, byteorder='big'))
-		block = data[iterator*block_size : (iterator+1)*block_size]
-		ciphertext = blockcipher.blockcipher(key_l, nonce_ctr_l, encrypt)
-		xor = [a ^ b for a, b in zip(block, ciphertext)]
-		crypted.extend(xor)
-		nonce_ctr += 1
-		iterator += 1
-
-	return crypted
+	raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
@@ -0,0 +1,96 @@
+import blockcipher
+
+import asyncio
+import socket
+
+encrypt = 0
+decrypt = 1
+
+# awaitable mode calls for asyncio. The data goes to blockcipher.JobQueue
+# workers, which run with the GIL released; the loop is woken through a
+# socket pair once results are ready and settles every finished future in
+# one pass, so a burst of requests costs the loop one wakeup
+
+class _Dispatcher:
+	def __init__( self, loop ):
+		self.loop = loop
+		self.rsock, self.wsock = socket.socketpair()
+		self.rsock.setblocking(False)
+		self.wsock.setblocking(False)
+		self.queue = blockcipher.JobQueue(self.wsock.fileno())
+		# asyncio.run cancels this task on the way out, which shuts the workers down
+		self.task = loop.create_task(self._run())
+
+	def _settle( self, done ):
+		for fut, result in done:
+			if not fut.cancelled():
+				fut.set_result(result)
+
+	async def _run( self ):
+		try:
+			while True:
+				await self.loop.sock_recv(self.rsock, 4096)
+				self._settle(self.queue.completed())
+		finally:
+			self._close()
+
+	# the queue goes first: its workers write to wsock until they stop
+	def _close( self ):
+		if _dispatchers.get(self.loop) is self:
+			del _dispatchers[self.loop]
+		self._settle(self.queue.close())
+		self.rsock.close()
+		self.wsock.close()
+
+	def submit( self, name, key, iv, data, mode ):
+		fut = self.loop.create_future()
+		self.queue.submit(fut, name, key, iv, data, mode)
+		return fut
+
+_dispatchers = {}
+
+# the dispatcher of the running loop, started on first use with one worker
+# per blockcipher.get_threads()
+def _dispatcher():
+	loop = asyncio.get_running_loop()
+	d = _dispatchers.get(loop)
+	if d is None:
+		d = _dispatchers[loop] = _Dispatcher(loop)
+	return d
+
+# stops the running loop's workers once what is queued has finished; only
+# needed for loops not run by asyncio.run
+def shutdown():
+	d = _dispatchers.get(asyncio.get_running_loop())
+	if d is not None:
+		d.task.cancel()
+
+def _check( mode ):
+	if mode not in (encrypt, decrypt):
+		raise ValueError('mode_in MUST be 0(encrypt) or 1(decrypt)')
+
+# each returns a future of the bytes the blockcipher function of the same
+# name returns, so trailing bytes short of a block are dropped as there
+def ecb( key, data, mode ):
+	_check(mode)
+	return _dispatcher().submit('ecb', key, None, data, mode)
+
+def cbc( key, iv, data, mode ):
+	_check(mode)
+	return _dispatcher().submit('cbc', key, iv, data, mode)
+
+def pcbc( key, iv, data, mode ):
+	_check(mode)
+	return _dispatcher().submit('pcbc', key, iv, data, mode)
+
+def cfb( key, iv, data, mode ):
+	_check(mode)
+	return _dispatcher().submit('cfb', key, iv, data, mode)
+
+def ofb( key, iv, data, mode ):
+	_check(mode)
+	return _dispatcher().submit('ofb', key, iv, data, mode)
+
+def ctr( key, nonce, data, mode ):
+	_check(mode)
+	return _dispatcher().submit('ctr', key, nonce, data, mode)
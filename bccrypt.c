@@ -0,0 +1,505 @@
+/**
+ * bccrypt: the blockcipher modes as a standalone command, without Python
+ *
+ *   bccrypt -e|-d -m MODE -k KEY [-i IV | -n NONCE] [-b BACKEND] [-t THREADS] [IN [OUT]]
+ *
+ * KEY and IV are hex, NONCE is the 64-bit ctr nonce as for blockcipher.ctr().
+ * IN and OUT default to stdin and stdout, "-" names them too. The work is a
+ * three-stage pipeline over a ring of large buffers: a reader thread fills
+ * them, the main thread runs the mode over each one in place (split across
+ * the worker pool for the modes that allow it) and a writer thread drains
+ * them, so reading, the cipher and writing all overlap.
+ *
+ * Built by `python3 setup.py build_cli`
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include "blockcipher_core.h"
+
+#define BUFFER_SIZE  (4 << 20) // bytes per pipeline buffer, a multiple of STATE_SIZE
+#define BUFFER_ALIGN 4096
+#define NUM_BUFFERS  4
+
+#ifdef _WIN32
+#define open_fd(path, flags, perm) _open(path, (flags) | _O_BINARY, perm)
+#define read_fd(fd, buf, len)      _read(fd, buf, (unsigned int)(len))
+#define write_fd(fd, buf, len)     _write(fd, buf, (unsigned int)(len))
+#define close_fd(fd)               _close(fd)
+#else
+#define open_fd(path, flags, perm) open(path, flags, perm)
+#define read_fd(fd, buf, len)      read(fd, buf, len)
+#define write_fd(fd, buf, len)     write(fd, buf, len)
+#define close_fd(fd)               close(fd)
+#endif
+
+enum { SLOT_FREE, SLOT_READ, SLOT_CRYPTED };
+
+typedef struct {
+	unsigned char *data;
+	size_t len;
+	int last;  // the final buffer of the input
+	int state; // SLOT_*, which stage owns it next
+} slot;
+
+/**
+ * The ring shared by the three stages. Each stage walks the slots in
+ * order and waits for the previous stage to hand a slot over; failed
+ * stops every stage
+**/
+static struct {
+	pool_mutex lock;
+	pool_cond changed;
+	slot slots[NUM_BUFFERS];
+	int in_fd;
+	int out_fd;
+	int failed;
+	const char *error; // what failed, for the message
+	int error_no;
+} ring;
+
+static void fail(const char *what, int error_no) {
+	mutex_lock(&ring.lock);
+	if (!ring.failed) {
+		ring.failed = 1;
+		ring.error = what;
+		ring.error_no = error_no;
+	}
+	cond_broadcast(&ring.changed);
+	mutex_unlock(&ring.lock);
+}
+
+// waits until slot s reaches state, returns 0 if the pipeline failed first
+static int wait_slot(slot *s, int state) {
+	mutex_lock(&ring.lock);
+	while (s->state != state && !ring.failed) {
+		cond_wait(&ring.changed, &ring.lock);
+	}
+	int ok = !ring.failed;
+	mutex_unlock(&ring.lock);
+	return ok;
+}
+
+static void pass_slot(slot *s, int state) {
+	mutex_lock(&ring.lock);
+	s->state = state;
+	cond_broadcast(&ring.changed);
+	mutex_unlock(&ring.lock);
+}
+
+// reads until the buffer is full or the input ends, so only the last buffer is short
+static void read_stage(void) {
+	for (int i = 0;; i = (i + 1) % NUM_BUFFERS) {
+		slot *s = &ring.slots[i];
+		if (!wait_slot(s, SLOT_FREE)) {
+			return;
+		}
+
+		s->len = 0;
+		s->last = 0;
+		while (s->len < BUFFER_SIZE) {
+			long n = (long)read_fd(ring.in_fd, s->data + s->len, BUFFER_SIZE - s->len);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				fail("read", errno);
+				return;
+			}
+			if (n == 0) {
+				s->last = 1;
+				break;
+			}
+			s->len += (size_t)n;
+		}
+
+		pass_slot(s, SLOT_READ);
+		if (s->last) {
+			return;
+		}
+	}
+}
+
+static void write_stage(void) {
+	for (int i = 0;; i = (i + 1) % NUM_BUFFERS) {
+		slot *s = &ring.slots[i];
+		if (!wait_slot(s, SLOT_CRYPTED)) {
+			return;
+		}
+
+		size_t done = 0;
+		while (done < s->len) {
+			long n = (long)write_fd(ring.out_fd, s->data + done, s->len - done);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				fail("write", errno);
+				return;
+			}
+			done += (size_t)n;
+		}
+
+		int last = s->last;
+		pass_slot(s, SLOT_FREE);
+		if (last) {
+			return;
+		}
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI reader_thread(LPVOID unused) {
+	read_stage();
+	return 0;
+}
+
+static DWORD WINAPI writer_thread(LPVOID unused) {
+	write_stage();
+	return 0;
+}
+#else
+static void* reader_thread(void *unused) {
+	read_stage();
+	return NULL;
+}
+
+static void* writer_thread(void *unused) {
+	write_stage();
+	return NULL;
+}
+#endif
+
+/**
+ * The cipher stage, on the calling thread. The chaining value carries from
+ * one buffer to the next exactly as StreamCipher.update() carries it, and
+ * a short final block is finished for the modes that allow one
+**/
+static void crypt_stage(const cipher_backend *be, const key_schedule *ks, int mode_id, unsigned char *chain, int mode) {
+	for (int i = 0;; i = (i + 1) % NUM_BUFFERS) {
+		slot *s = &ring.slots[i];
+		if (!wait_slot(s, SLOT_READ)) {
+			return;
+		}
+
+		size_t blocks = s->len / STATE_SIZE;
+		size_t tail = s->len % STATE_SIZE;
+		if (tail > 0 && !mode_streams(mode_id)) {
+			fail("input is not a multiple of 16 bytes for this mode", 0);
+			return;
+		}
+
+		if (blocks > 0) {
+			unsigned char last_in[STATE_SIZE];
+			unsigned char *last = s->data + (blocks - 1) * STATE_SIZE;
+			memcpy(last_in, last, STATE_SIZE);
+			crypt_mode(be, ks, mode_id, chain, s->data, s->data, blocks, mode);
+			advance_chain(mode_id, mode, chain, last_in, last, blocks);
+		}
+		if (tail > 0) {
+			crypt_tail(be, ks, chain, s->data + blocks * STATE_SIZE, s->data + blocks * STATE_SIZE, tail);
+		}
+
+		int last = s->last;
+		pass_slot(s, SLOT_CRYPTED);
+		if (last) {
+			return;
+		}
+	}
+}
+
+static void* alloc_aligned(size_t size) {
+#ifdef _WIN32
+	return _aligned_malloc(size, BUFFER_ALIGN);
+#else
+	void *p;
+	return posix_memalign(&p, BUFFER_ALIGN, size) == 0 ? p : NULL;
+#endif
+}
+
+static void free_aligned(void *p) {
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/**
+ * OUT is opened without truncating it, and only cut to zero length once it
+ * is known not to be the file IN reads, whatever path or link named the
+ * two. Only regular files are truncated, and removed again on failure
+**/
+#ifdef _WIN32
+static int same_file(int a, int b) {
+	BY_HANDLE_FILE_INFORMATION x, y;
+	if (!GetFileInformationByHandle((HANDLE)_get_osfhandle(a), &x) ||
+			!GetFileInformationByHandle((HANDLE)_get_osfhandle(b), &y)) {
+		return 0;
+	}
+	return x.dwVolumeSerialNumber == y.dwVolumeSerialNumber &&
+		x.nFileIndexHigh == y.nFileIndexHigh && x.nFileIndexLow == y.nFileIndexLow;
+}
+
+static int is_regular(int fd) {
+	return GetFileType((HANDLE)_get_osfhandle(fd)) == FILE_TYPE_DISK;
+}
+
+static int truncate_fd(int fd) {
+	return _chsize(fd, 0);
+}
+#else
+static int same_file(int a, int b) {
+	struct stat x, y;
+	if (fstat(a, &x) != 0 || fstat(b, &y) != 0) {
+		return 0;
+	}
+	return x.st_dev == y.st_dev && x.st_ino == y.st_ino;
+}
+
+static int is_regular(int fd) {
+	struct stat st;
+	return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static int truncate_fd(int fd) {
+	return ftruncate(fd, 0);
+}
+#endif
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// returns the number of bytes parsed into out, or -1 if s is not hex of at most max bytes
+static int parse_hex(const char *s, unsigned char *out, size_t max) {
+	size_t len = strlen(s);
+	if (len % 2 != 0 || len / 2 > max) {
+		return -1;
+	}
+	for (size_t i = 0; i < len / 2; i++) {
+		int hi = hex_value(s[2 * i]), lo = hex_value(s[2 * i + 1]);
+		if (hi < 0 || lo < 0) {
+			return -1;
+		}
+		out[i] = (unsigned char)(hi << 4 | lo);
+	}
+	return (int)(len / 2);
+}
+
+static int usage(const char *msg) {
+	if (msg != NULL) {
+		fprintf(stderr, "bccrypt: %s\n", msg);
+	}
+	fprintf(stderr,
+		"usage: bccrypt -e|-d -m MODE -k KEY [-i IV | -n NONCE] [-b BACKEND] [-t THREADS] [IN [OUT]]\n"
+		"  MODE     ecb, cbc, pcbc, cfb, ofb or ctr\n"
+		"  KEY      16, 24 or 32 bytes as hex\n"
+		"  IV       16 bytes as hex; for ctr the whole first counter block\n"
+		"  NONCE    ctr nonce, the counter block is the nonce then a 64-bit zero count\n"
+		"  BACKEND  cipher backend, the fastest available by default\n"
+		"  THREADS  threads for the modes that split, 0 for one per CPU (the default)\n"
+		"  IN, OUT  files, stdin and stdout when left out or \"-\"\n");
+	return 2;
+}
+
+int main(int argc, char **argv) {
+	int mode = -1;
+	const char *mode_name = NULL;
+	const char *key_hex = NULL;
+	const char *iv_hex = NULL;
+	const char *nonce_text = NULL;
+	const char *backend_name = NULL;
+	int threads = 0;
+	const char *paths[2] = { "-", "-" };
+	int npaths = 0;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' && strchr("mkinbt", arg[1]) != NULL) {
+			if (i + 1 >= argc) {
+				return usage("missing option value");
+			}
+			const char *value = argv[++i];
+			switch (arg[1]) {
+			case 'm': mode_name = value; break;
+			case 'k': key_hex = value; break;
+			case 'i': iv_hex = value; break;
+			case 'n': nonce_text = value; break;
+			case 'b': backend_name = value; break;
+			case 't': threads = atoi(value); break;
+			}
+		} else if (strcmp(arg, "-e") == 0) {
+			mode = ENCRYPT;
+		} else if (strcmp(arg, "-d") == 0) {
+			mode = DECRYPT;
+		} else if (strcmp(arg, "-h") == 0) {
+			usage(NULL);
+			return 0;
+		} else if (arg[0] != '-' || arg[1] == '\0') {
+			if (npaths == 2) {
+				return usage("too many files");
+			}
+			paths[npaths++] = arg;
+		} else {
+			return usage("unknown option");
+		}
+	}
+
+	if (mode < 0 || mode_name == NULL || key_hex == NULL) {
+		return usage("-e or -d, -m and -k are required");
+	}
+	int mode_id = find_mode(mode_name);
+	if (mode_id < 0) {
+		return usage("unknown mode");
+	}
+
+	unsigned char key[MAX_KEY_SIZE];
+	int key_size = parse_hex(key_hex, key, sizeof(key));
+	if (key_size < 0 || rounds_for_key(key_size) == 0) {
+		return usage("KEY must be 16, 24 or 32 bytes of hex");
+	}
+
+	unsigned char chain[STATE_SIZE] = { 0 };
+	if (mode_id == MODE_CTR && nonce_text != NULL) {
+		nonce_counter_block(strtoull(nonce_text, NULL, 0), chain);
+	} else if (mode_id != MODE_ECB) {
+		if (iv_hex == NULL || parse_hex(iv_hex, chain, sizeof(chain)) != STATE_SIZE) {
+			return usage(mode_id == MODE_CTR ? "ctr needs -n NONCE or a 16-byte -i IV" : "IV must be 16 bytes of hex");
+		}
+	}
+
+	init_core();
+	const cipher_backend *be = default_backend();
+	if (backend_name != NULL) {
+		be = find_backend(backend_name);
+		if (be == NULL || !backend_supported(be)) {
+			return usage("unknown or unsupported backend");
+		}
+	}
+	if (threads <= 0) {
+		threads = cpu_count();
+	}
+	store_pool_threads(threads);
+
+	key_schedule ks;
+	schedule_key(be, key, key_size, &ks);
+	if (mode == DECRYPT && modes[mode_id].uses_inverse) {
+		prepare_decrypt(be, &ks);
+	}
+
+	int status = 1;
+	int remove_out = 0;
+	ring.in_fd = -1;
+	ring.out_fd = -1;
+	if (strcmp(paths[0], "-") == 0) {
+		ring.in_fd = 0;
+	} else if ((ring.in_fd = open_fd(paths[0], O_RDONLY, 0)) < 0) {
+		fprintf(stderr, "bccrypt: %s: %s\n", paths[0], strerror(errno));
+		goto done;
+	}
+	if (strcmp(paths[1], "-") == 0) {
+		ring.out_fd = 1;
+	} else if ((ring.out_fd = open_fd(paths[1], O_WRONLY | O_CREAT, 0666)) < 0) {
+		fprintf(stderr, "bccrypt: %s: %s\n", paths[1], strerror(errno));
+		goto done;
+	}
+	if (same_file(ring.in_fd, ring.out_fd)) {
+		fprintf(stderr, "bccrypt: IN and OUT must be different files\n");
+		goto done;
+	}
+	if (ring.out_fd != 1 && is_regular(ring.out_fd)) {
+		remove_out = 1;
+		if (truncate_fd(ring.out_fd) != 0) {
+			fprintf(stderr, "bccrypt: %s: %s\n", paths[1], strerror(errno));
+			goto done;
+		}
+	}
+#ifdef _WIN32
+	_setmode(ring.in_fd, _O_BINARY);
+	_setmode(ring.out_fd, _O_BINARY);
+#endif
+
+	mutex_init(&ring.lock);
+	cond_init(&ring.changed);
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		ring.slots[i].data = alloc_aligned(BUFFER_SIZE);
+		if (ring.slots[i].data == NULL) {
+			fprintf(stderr, "bccrypt: out of memory\n");
+			goto done;
+		}
+		ring.slots[i].state = SLOT_FREE;
+	}
+
+#ifdef _WIN32
+	HANDLE reader = CreateThread(NULL, 0, reader_thread, NULL, 0, NULL);
+	HANDLE writer = CreateThread(NULL, 0, writer_thread, NULL, 0, NULL);
+	if (reader == NULL || writer == NULL) {
+		fprintf(stderr, "bccrypt: cannot start threads\n");
+		goto done;
+	}
+	crypt_stage(be, &ks, mode_id, chain, mode);
+	WaitForSingleObject(reader, INFINITE);
+	WaitForSingleObject(writer, INFINITE);
+	CloseHandle(reader);
+	CloseHandle(writer);
+#else
+	pthread_t reader, writer;
+	if (pthread_create(&reader, NULL, reader_thread, NULL) != 0) {
+		fprintf(stderr, "bccrypt: cannot start threads\n");
+		goto done;
+	}
+	if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+		fail("cannot start threads", 0);
+		pthread_join(reader, NULL);
+		fprintf(stderr, "bccrypt: cannot start threads\n");
+		goto done;
+	}
+	crypt_stage(be, &ks, mode_id, chain, mode);
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+#endif
+
+	if (ring.failed) {
+		if (ring.error_no != 0) {
+			fprintf(stderr, "bccrypt: %s: %s\n", ring.error, strerror(ring.error_no));
+		} else {
+			fprintf(stderr, "bccrypt: %s\n", ring.error);
+		}
+	} else {
+		status = 0;
+	}
+
+done:
+	if (ring.out_fd > 1 && close_fd(ring.out_fd) != 0 && status == 0) {
+		fprintf(stderr, "bccrypt: %s: %s\n", paths[1], strerror(errno));
+		status = 1;
+	}
+	// a partial OUT would pass for a finished one
+	if (status != 0 && remove_out) {
+		remove(paths[1]);
+	}
+	if (ring.in_fd > 0) {
+		close_fd(ring.in_fd);
+	}
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		free_aligned(ring.slots[i].data);
+	}
+	return status;
+}
@@ -0,0 +1,276 @@
+import blockcipher
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import sys
+import time
+
+block_size = 16
+encrypt = 0
+decrypt = 1
+
+modes = ('ecb', 'cbc', 'pcbc', 'cfb', 'ofb', 'ctr')
+directions = (('encrypt', encrypt), ('decrypt', decrypt))
+
+# 16 B up to 256 MB; the largest sizes are opt-in with --max-size
+default_sizes = (16, 256, 4096, 65536, 1 << 20, 16 << 20)
+all_sizes = default_sizes + (64 << 20, 256 << 20)
+
+# FIPS-197 appendix C: (key, plaintext, ciphertext), all in the standard byte order
+fips_vectors = (
+	('000102030405060708090a0b0c0d0e0f',
+	 '00112233445566778899aabbccddeeff', '69c4e0d86a7b0430d8cdb78070b4c55a'),
+	('000102030405060708090a0b0c0d0e0f1011121314151617',
+	 '00112233445566778899aabbccddeeff', 'dda97ca4864cdfe06eaf70a0ec0d7191'),
+	('000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f',
+	 '00112233445566778899aabbccddeeff', '8ea2b7ca516745bfeafc49904b496089'),
+)
+
+# GCM test cases 1, 2 and 4 from the GCM specification: (key, iv, plaintext, aad, ciphertext, tag)
+gcm_vectors = (
+	('00000000000000000000000000000000', '000000000000000000000000', '', '', '',
+	 '58e2fccefa7e3061367f1d57a4e7455a'),
+	('00000000000000000000000000000000', '000000000000000000000000',
+	 '00000000000000000000000000000000', '', '0388dace60b6a392f328c2b971b2fe78',
+	 'ab6e47d42cec13bdf53a67b21257bddf'),
+	('feffe9928665731c6d6a8f9467308308', 'cafebabefacedbaddecaf888',
+	 'd9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72'
+	 '1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39',
+	 'feedfacedeadbeeffeedfacedeadbeefabaddad2',
+	 '42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e'
+	 '21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091',
+	 '5bc94fbc3221a5db94fae95ae7121a47'),
+)
+
+# IEEE 1619 XTS-AES-128 vectors 1 to 3: (key1, key2, sector, plaintext, ciphertext)
+xts_vectors = (
+	('00000000000000000000000000000000', '00000000000000000000000000000000', 0,
+	 '00' * 32, '917cf69ebd68b2ec9b9fe9a3eadda692cd43d2f59598ed858c02c2652fbf922e'),
+	('11111111111111111111111111111111', '22222222222222222222222222222222', 0x3333333333,
+	 '44' * 32, 'c454185e6a16936e39334038acef838bfb186fff7480adc4289382ecd6d394f0'),
+	('fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0', '22222222222222222222222222222222', 0x3333333333,
+	 '44' * 32, 'af85336b597afc1a900b2eb21ec949d292df4c047e0b21532186a5971a227a89'),
+)
+
+# blockcipher keeps the state row by row where FIPS-197 fills it column by column
+def transpose_block( block ):
+	return bytes(block[4*(i % 4) + i//4] for i in range(block_size))
+
+def transpose_key( key ):
+	nk = len(key) // 4
+	return bytes(key[4*(i % nk) + i//nk] for i in range(len(key)))
+
+def run_mode( name, key, iv, data, mode ):
+	if name == 'ecb':
+		return blockcipher.ecb(key, data, mode)
+	if name == 'ctr':
+		return getattr(blockcipher, name)(key, int.from_bytes(iv[:8], 'big'), data, mode)
+	return getattr(blockcipher, name)(key, iv, data, mode)
+
+# checks the single-block calls and the batched, threaded ECB path against
+# FIPS-197, then every mode against the reference backend
+def verify( backend, threads ):
+	failures = []
+	blockcipher.set_threads(threads)
+	blockcipher.set_parallel_threshold(4096)
+
+	for key_hex, pt_hex, ct_hex in fips_vectors:
+		key = blockcipher.Key(transpose_key(bytes.fromhex(key_hex)))
+		pt = transpose_block(bytes.fromhex(pt_hex))
+		ct = transpose_block(bytes.fromhex(ct_hex))
+		bits = len(key_hex) * 4
+
+		blockcipher.set_backend(backend)
+		if bytes(blockcipher.encrypt(key, pt)) != ct:
+			failures.append('AES-%d encrypt' % bits)
+		if bytes(blockcipher.decrypt(key, ct)) != pt:
+			failures.append('AES-%d decrypt' % bits)
+
+		# enough copies to cross the batching and thread split boundaries
+		copies = 1021
+		if bytes(blockcipher.ecb(key, pt * copies, encrypt)) != ct * copies:
+			failures.append('AES-%d ecb encrypt' % bits)
+		if bytes(blockcipher.ecb(key, ct * copies, decrypt)) != pt * copies:
+			failures.append('AES-%d ecb decrypt' % bits)
+
+	# GCM takes the iv, data and tag as standard byte strings; only the key is transposed
+	for key_hex, iv_hex, pt_hex, aad_hex, ct_hex, tag_hex in gcm_vectors:
+		key = blockcipher.Key(transpose_key(bytes.fromhex(key_hex)))
+		iv, pt, aad = bytes.fromhex(iv_hex), bytes.fromhex(pt_hex), bytes.fromhex(aad_hex)
+		expected = (bytes.fromhex(ct_hex), bytes.fromhex(tag_hex))
+		if blockcipher.gcm_encrypt(key, iv, pt, aad) != expected:
+			failures.append('%d-byte gcm encrypt' % len(pt))
+		elif blockcipher.gcm_decrypt(key, iv, expected[0], expected[1], aad) != pt:
+			failures.append('%d-byte gcm decrypt' % len(pt))
+
+	# XTS also takes the data as standard byte strings
+	for key1_hex, key2_hex, sector, pt_hex, ct_hex in xts_vectors:
+		key1 = blockcipher.Key(transpose_key(bytes.fromhex(key1_hex)))
+		key2 = blockcipher.Key(transpose_key(bytes.fromhex(key2_hex)))
+		pt, ct = bytes.fromhex(pt_hex), bytes.fromhex(ct_hex)
+		if bytes(blockcipher.xts_encrypt(key1, key2, pt, len(pt), sector)) != ct:
+			failures.append('xts encrypt, sector %#x' % sector)
+		if bytes(blockcipher.xts_decrypt(key1, key2, ct, len(ct), sector)) != pt:
+			failures.append('xts decrypt, sector %#x' % sector)
+
+	# ciphertext stealing and the sector split, against the reference backend
+	key1 = blockcipher.Key(os.urandom(32))
+	key2 = blockcipher.Key(os.urandom(16))
+	for sector_size in (block_size, block_size + 5, 512):
+		data = os.urandom(sector_size * 67)
+		blockcipher.set_backend('reference')
+		expected = bytes(blockcipher.xts_encrypt(key1, key2, data, sector_size, 1 << 40))
+		blockcipher.set_backend(backend)
+		ct = bytes(blockcipher.xts_encrypt(key1, key2, data, sector_size, 1 << 40))
+		if ct != expected:
+			failures.append('%d-byte sector xts encrypt' % sector_size)
+		if bytes(blockcipher.xts_decrypt(key1, key2, ct, sector_size, 1 << 40)) != data:
+			failures.append('%d-byte sector xts round trip' % sector_size)
+
+	data = os.urandom(1021 * block_size)
+	iv = os.urandom(block_size)
+	for key_size in (16, 24, 32):
+		key = blockcipher.Key(os.urandom(key_size))
+		for name in modes:
+			for direction, mode in directions:
+				blockcipher.set_backend('reference')
+				expected = bytes(run_mode(name, key, iv, data, mode))
+				blockcipher.set_backend(backend)
+				if bytes(run_mode(name, key, iv, data, mode)) != expected:
+					failures.append('AES-%d %s %s' % (key_size * 8, name, direction))
+
+	# empty, tail-only and one-block inputs with every call eligible for the
+	# thread split; short inputs must stay on one thread, not divide by zero
+	blockcipher.set_threads(max(threads, 2))
+	blockcipher.set_parallel_threshold(0)
+	key = blockcipher.Key(os.urandom(16))
+	for size in (0, 5, block_size, block_size + 5):
+		data = os.urandom(size)
+		for name in modes:
+			for direction, mode in directions:
+				blockcipher.set_backend('reference')
+				expected = bytes(run_mode(name, key, iv, data, mode))
+				blockcipher.set_backend(backend)
+				if bytes(run_mode(name, key, iv, data, mode)) != expected:
+					failures.append('%d-byte %s %s' % (size, name, direction))
+		# decrypt_range always runs a ctr tail, whole blocks or not
+		stream = blockcipher.CTREncryptor(key, 1)
+		ct = stream.update(data) + stream.finalize()
+		if bytes(blockcipher.decrypt_range('ctr', key, 1, ct, 0, size)) != data:
+			failures.append('%d-byte ctr decrypt_range' % size)
+	blockcipher.set_threads(threads)
+	blockcipher.set_parallel_threshold(4096)
+
+	return failures
+
+def cpu_hz():
+	try:
+		with open('/proc/cpuinfo') as f:
+			for line in f:
+				if line.startswith('cpu MHz'):
+					return float(line.split(':')[1]) * 1e6
+	except OSError:
+		pass
+	return None
+
+# times calls until min_time has passed, at least 3 of them
+def measure( fn, nbytes, min_time, hz ):
+	times = []
+	start = time.perf_counter()
+	while len(times) < 3 or time.perf_counter() - start < min_time:
+		t = time.perf_counter()
+		fn()
+		times.append(time.perf_counter() - t)
+
+	best = min(times)
+	result = {
+		'calls': len(times),
+		'best_s': best,
+		'median_s': statistics.median(times),
+		'mb_per_s': nbytes / best / 1e6,
+		'cycles_per_byte': best * hz / nbytes if hz else None,
+	}
+	return result
+
+def parse_args():
+	parser = argparse.ArgumentParser(description='Benchmarks blockcipher across modes, backends and message sizes')
+	parser.add_argument('--backends', nargs='+', default=None, help='backends to run, default every available one')
+	parser.add_argument('--modes', nargs='+', default=list(modes), choices=modes)
+	parser.add_argument('--sizes', nargs='+', type=int, default=None, help='message sizes in bytes')
+	parser.add_argument('--max-size', type=int, default=default_sizes[-1], help='drops sizes above this, up to %d' % all_sizes[-1])
+	parser.add_argument('--key-sizes', nargs='+', type=int, default=[16], choices=(16, 24, 32))
+	parser.add_argument('--threads', nargs='+', type=int, default=None, help='thread counts, default 1 and one per CPU')
+	parser.add_argument('--min-time', type=float, default=0.2, help='seconds spent on each measurement')
+	parser.add_argument('--ghz', type=float, default=None, help='clock for cycles/byte, read from /proc/cpuinfo if left out')
+	parser.add_argument('--output', default='bench_output.json')
+	parser.add_argument('--skip-verify', action='store_true')
+	return parser.parse_args()
+
+def main():
+	args = parse_args()
+
+	backends = args.backends or list(blockcipher.backends())
+	sizes = args.sizes or [s for s in all_sizes if s <= args.max_size]
+	threads = args.threads or sorted({1, os.cpu_count() or 1})
+	hz = args.ghz * 1e9 if args.ghz else cpu_hz()
+
+	default_backend = blockcipher.get_backend()
+	default_threads = blockcipher.get_threads()
+	default_threshold = blockcipher.get_parallel_threshold()
+
+	report = {
+		'machine': {
+			'platform': platform.platform(),
+			'processor': platform.processor(),
+			'python': platform.python_version(),
+			'cpus': os.cpu_count(),
+			'hz': hz,
+		},
+		'verify': {},
+		'results': [],
+	}
+
+	failed = False
+	if not args.skip_verify:
+		for backend in backends:
+			failures = verify(backend, max(threads))
+			report['verify'][backend] = failures or 'ok'
+			print('verify %-14s %s' % (backend, ', '.join(failures) or 'ok'))
+			failed = failed or bool(failures)
+
+	blockcipher.set_parallel_threshold(default_threshold)
+	iv = os.urandom(block_size)
+	for key_size in args.key_sizes:
+		key = blockcipher.Key(os.urandom(key_size))
+		for size in sizes:
+			data = os.urandom(size - size % block_size or block_size)
+			for backend in backends:
+				blockcipher.set_backend(backend)
+				for n in threads:
+					blockcipher.set_threads(n)
+					for name in args.modes:
+						for direction, mode in directions:
+							result = measure(lambda: run_mode(name, key, iv, data, mode), len(data), args.min_time, hz)
+							result.update({
+								'backend': backend, 'mode': name, 'direction': direction,
+								'key_size': key_size, 'bytes': len(data), 'threads': n,
+							})
+							report['results'].append(result)
+							cpb = '%8.2f c/B' % result['cycles_per_byte'] if hz else ''
+							print('%-14s AES-%d %-4s %-7s %10d B %2d thr %10.1f MB/s %s' % (
+								backend, key_size * 8, name, direction, len(data), n, result['mb_per_s'], cpb))
+
+	blockcipher.set_backend(default_backend)
+	blockcipher.set_threads(default_threads)
+
+	with open(args.output, 'w') as f:
+		json.dump(report, f, indent=1)
+	print('wrote', args.output)
+
+	return 1 if failed else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
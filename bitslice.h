@@ -0,0 +1,425 @@
+/**
+ * Bitsliced AES rounds, included by blockcipher_core.c once per register width.
+ * The includer defines:
+ *
+ *   BS_WORD             register type, a whole number of 64-bit lanes
+ *   BS_NAME(x)          x with the variant's suffix appended
+ *   BS_TARGET           function attributes for the instruction set
+ *   BS_XOR, BS_AND      bitwise operations on two words
+ *   BS_NOT(a)           complement
+ *   BS_SHL, BS_SHR      shifts within each 64-bit lane
+ *   BS_ROTR32(a)        swaps the two 32-bit halves of each 64-bit lane
+ *   BS_SET1(x)          the 64-bit constant x in every lane
+ *
+ * Each 64-bit lane holds four blocks in the ct64 layout: q[i] carries bit i
+ * of every byte, 16 bits per state row and block. A BS_WORD of n lanes runs
+ * 4n blocks through each round at once. Nothing below indexes memory or
+ * branches on key or data, so timing does not depend on either
+**/
+
+#define BS_LANES  (sizeof(BS_WORD) / sizeof(uint64_t))
+#define BS_BLOCKS (4 * BS_LANES)
+#define BS_OR(a, b) BS_XOR(a, b) // only ever used on disjoint bits
+
+/**
+ * The S-box as a 113-gate circuit (Boyar and Peralta). x0 is the high bit
+ * of the input byte and s0 the high bit of the output
+**/
+BS_TARGET static void BS_NAME(sbox)(BS_WORD *q) {
+	BS_WORD x0, x1, x2, x3, x4, x5, x6, x7;
+	BS_WORD y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11;
+	BS_WORD y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+	BS_WORD z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	BS_WORD z10, z11, z12, z13, z14, z15, z16, z17;
+	BS_WORD t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	BS_WORD t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	BS_WORD t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	BS_WORD t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	BS_WORD t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	BS_WORD t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	BS_WORD t60, t61, t62, t63, t64, t65, t66, t67;
+	BS_WORD s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	// top linear transformation
+	y14 = BS_XOR(x3, x5);
+	y13 = BS_XOR(x0, x6);
+	y9 = BS_XOR(x0, x3);
+	y8 = BS_XOR(x0, x5);
+	t0 = BS_XOR(x1, x2);
+	y1 = BS_XOR(t0, x7);
+	y4 = BS_XOR(y1, x3);
+	y12 = BS_XOR(y13, y14);
+	y2 = BS_XOR(y1, x0);
+	y5 = BS_XOR(y1, x6);
+	y3 = BS_XOR(y5, y8);
+	t1 = BS_XOR(x4, y12);
+	y15 = BS_XOR(t1, x5);
+	y20 = BS_XOR(t1, x1);
+	y6 = BS_XOR(y15, x7);
+	y10 = BS_XOR(y15, t0);
+	y11 = BS_XOR(y20, y9);
+	y7 = BS_XOR(x7, y11);
+	y17 = BS_XOR(y10, y11);
+	y19 = BS_XOR(y10, y8);
+	y16 = BS_XOR(t0, y11);
+	y21 = BS_XOR(y13, y16);
+	y18 = BS_XOR(x0, y16);
+
+	// non-linear section, the inversion in GF(2^4)^2
+	t2 = BS_AND(y12, y15);
+	t3 = BS_AND(y3, y6);
+	t4 = BS_XOR(t3, t2);
+	t5 = BS_AND(y4, x7);
+	t6 = BS_XOR(t5, t2);
+	t7 = BS_AND(y13, y16);
+	t8 = BS_AND(y5, y1);
+	t9 = BS_XOR(t8, t7);
+	t10 = BS_AND(y2, y7);
+	t11 = BS_XOR(t10, t7);
+	t12 = BS_AND(y9, y11);
+	t13 = BS_AND(y14, y17);
+	t14 = BS_XOR(t13, t12);
+	t15 = BS_AND(y8, y10);
+	t16 = BS_XOR(t15, t12);
+	t17 = BS_XOR(t4, t14);
+	t18 = BS_XOR(t6, t16);
+	t19 = BS_XOR(t9, t14);
+	t20 = BS_XOR(t11, t16);
+	t21 = BS_XOR(t17, y20);
+	t22 = BS_XOR(t18, y19);
+	t23 = BS_XOR(t19, y21);
+	t24 = BS_XOR(t20, y18);
+
+	t25 = BS_XOR(t21, t22);
+	t26 = BS_AND(t21, t23);
+	t27 = BS_XOR(t24, t26);
+	t28 = BS_AND(t25, t27);
+	t29 = BS_XOR(t28, t22);
+	t30 = BS_XOR(t23, t24);
+	t31 = BS_XOR(t22, t26);
+	t32 = BS_AND(t31, t30);
+	t33 = BS_XOR(t32, t24);
+	t34 = BS_XOR(t23, t33);
+	t35 = BS_XOR(t27, t33);
+	t36 = BS_AND(t24, t35);
+	t37 = BS_XOR(t36, t34);
+	t38 = BS_XOR(t27, t36);
+	t39 = BS_AND(t29, t38);
+	t40 = BS_XOR(t25, t39);
+
+	t41 = BS_XOR(t40, t37);
+	t42 = BS_XOR(t29, t33);
+	t43 = BS_XOR(t29, t40);
+	t44 = BS_XOR(t33, t37);
+	t45 = BS_XOR(t42, t41);
+	z0 = BS_AND(t44, y15);
+	z1 = BS_AND(t37, y6);
+	z2 = BS_AND(t33, x7);
+	z3 = BS_AND(t43, y16);
+	z4 = BS_AND(t40, y1);
+	z5 = BS_AND(t29, y7);
+	z6 = BS_AND(t42, y11);
+	z7 = BS_AND(t45, y17);
+	z8 = BS_AND(t41, y10);
+	z9 = BS_AND(t44, y12);
+	z10 = BS_AND(t37, y3);
+	z11 = BS_AND(t33, y4);
+	z12 = BS_AND(t43, y13);
+	z13 = BS_AND(t40, y5);
+	z14 = BS_AND(t29, y2);
+	z15 = BS_AND(t42, y9);
+	z16 = BS_AND(t45, y14);
+	z17 = BS_AND(t41, y8);
+
+	// bottom linear transformation
+	t46 = BS_XOR(z15, z16);
+	t47 = BS_XOR(z10, z11);
+	t48 = BS_XOR(z5, z13);
+	t49 = BS_XOR(z9, z10);
+	t50 = BS_XOR(z2, z12);
+	t51 = BS_XOR(z2, z5);
+	t52 = BS_XOR(z7, z8);
+	t53 = BS_XOR(z0, z3);
+	t54 = BS_XOR(z6, z7);
+	t55 = BS_XOR(z16, z17);
+	t56 = BS_XOR(z12, t48);
+	t57 = BS_XOR(t50, t53);
+	t58 = BS_XOR(z4, t46);
+	t59 = BS_XOR(z3, t54);
+	t60 = BS_XOR(t46, t57);
+	t61 = BS_XOR(z14, t57);
+	t62 = BS_XOR(t52, t58);
+	t63 = BS_XOR(t49, t58);
+	t64 = BS_XOR(z4, t59);
+	t65 = BS_XOR(t61, t62);
+	t66 = BS_XOR(z1, t63);
+	s0 = BS_XOR(t59, t63);
+	s6 = BS_XOR(t56, BS_NOT(t62));
+	s7 = BS_XOR(t48, BS_NOT(t60));
+	t67 = BS_XOR(t64, t65);
+	s3 = BS_XOR(t53, t66);
+	s4 = BS_XOR(t51, t66);
+	s5 = BS_XOR(t47, t65);
+	s1 = BS_XOR(t64, BS_NOT(s3));
+	s2 = BS_XOR(t55, BS_NOT(t67));
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/**
+ * The inverse S-box is f(S(f(x))) where f(x) = A^-1(x) ^ 0x05 undoes the
+ * S-box's affine step, so it reuses the circuit above
+**/
+BS_TARGET static void BS_NAME(inv_affine)(BS_WORD *q) {
+	BS_WORD q0 = BS_NOT(q[0]);
+	BS_WORD q1 = BS_NOT(q[1]);
+	BS_WORD q2 = q[2];
+	BS_WORD q3 = q[3];
+	BS_WORD q4 = q[4];
+	BS_WORD q5 = BS_NOT(q[5]);
+	BS_WORD q6 = BS_NOT(q[6]);
+	BS_WORD q7 = q[7];
+
+	q[7] = BS_XOR(BS_XOR(q1, q4), q6);
+	q[6] = BS_XOR(BS_XOR(q0, q3), q5);
+	q[5] = BS_XOR(BS_XOR(q7, q2), q4);
+	q[4] = BS_XOR(BS_XOR(q6, q1), q3);
+	q[3] = BS_XOR(BS_XOR(q5, q0), q2);
+	q[2] = BS_XOR(BS_XOR(q4, q7), q1);
+	q[1] = BS_XOR(BS_XOR(q3, q6), q0);
+	q[0] = BS_XOR(BS_XOR(q2, q5), q7);
+}
+
+BS_TARGET static void BS_NAME(inv_sbox)(BS_WORD *q) {
+	BS_NAME(inv_affine)(q);
+	BS_NAME(sbox)(q);
+	BS_NAME(inv_affine)(q);
+}
+
+// swaps the bits selected by lo in y with those s places higher in x
+#define BS_SWAPN(lo, hi, s, x, y) do { \
+		BS_WORD a_ = (x), b_ = (y); \
+		(x) = BS_OR(BS_AND(a_, BS_SET1(lo)), BS_SHL(BS_AND(b_, BS_SET1(lo)), s)); \
+		(y) = BS_OR(BS_SHR(BS_AND(a_, BS_SET1(hi)), s), BS_AND(b_, BS_SET1(hi))); \
+	} while (0)
+
+/**
+ * Transposes between eight words of interleaved bytes and eight bit
+ * planes. It is its own inverse
+**/
+BS_TARGET static void BS_NAME(ortho)(BS_WORD *q) {
+	BS_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, q[0], q[1]);
+	BS_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, q[2], q[3]);
+	BS_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, q[4], q[5]);
+	BS_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, q[6], q[7]);
+
+	BS_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, q[0], q[2]);
+	BS_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, q[1], q[3]);
+	BS_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, q[4], q[6]);
+	BS_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, q[5], q[7]);
+
+	BS_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, q[0], q[4]);
+	BS_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, q[1], q[5]);
+	BS_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, q[2], q[6]);
+	BS_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, q[3], q[7]);
+}
+
+#undef BS_SWAPN
+
+BS_TARGET static void BS_NAME(add_round_key)(BS_WORD *q, const uint64_t *sk) {
+	for (int i = 0; i < 8; i++) {
+		q[i] = BS_XOR(q[i], BS_SET1(sk[i]));
+	}
+}
+
+// each row is a 16-bit group of four 4-bit columns; row r rotates by r columns
+BS_TARGET static void BS_NAME(shift_rows)(BS_WORD *q) {
+	for (int i = 0; i < 8; i++) {
+		BS_WORD x = q[i];
+		q[i] = BS_OR(BS_OR(BS_OR(BS_AND(x, BS_SET1(0x000000000000FFFFULL)),
+			BS_SHR(BS_AND(x, BS_SET1(0x00000000FFF00000ULL)), 4)),
+			BS_OR(BS_SHL(BS_AND(x, BS_SET1(0x00000000000F0000ULL)), 12),
+			BS_SHR(BS_AND(x, BS_SET1(0x0000FF0000000000ULL)), 8))),
+			BS_OR(BS_OR(BS_SHL(BS_AND(x, BS_SET1(0x000000FF00000000ULL)), 8),
+			BS_SHR(BS_AND(x, BS_SET1(0xF000000000000000ULL)), 12)),
+			BS_SHL(BS_AND(x, BS_SET1(0x0FFF000000000000ULL)), 4)));
+	}
+}
+
+BS_TARGET static void BS_NAME(inv_shift_rows)(BS_WORD *q) {
+	for (int i = 0; i < 8; i++) {
+		BS_WORD x = q[i];
+		q[i] = BS_OR(BS_OR(BS_OR(BS_AND(x, BS_SET1(0x000000000000FFFFULL)),
+			BS_SHL(BS_AND(x, BS_SET1(0x000000000FFF0000ULL)), 4)),
+			BS_OR(BS_SHR(BS_AND(x, BS_SET1(0x00000000F0000000ULL)), 12),
+			BS_SHL(BS_AND(x, BS_SET1(0x000000FF00000000ULL)), 8))),
+			BS_OR(BS_OR(BS_SHR(BS_AND(x, BS_SET1(0x0000FF0000000000ULL)), 8),
+			BS_SHL(BS_AND(x, BS_SET1(0x000F000000000000ULL)), 12)),
+			BS_SHR(BS_AND(x, BS_SET1(0xFFF0000000000000ULL)), 4)));
+	}
+}
+
+// rotates every lane down one row
+#define BS_ROTR16(x) BS_XOR(BS_SHR(x, 16), BS_SHL(x, 48))
+
+/**
+ * MixColumns: r is the state one row down, so each output bit plane is
+ * 2 * (a ^ r) ^ r ^ (the two rows beyond), with the doubling done by
+ * moving planes up one and folding bit 7 back in at planes 0, 1, 3 and 4
+**/
+BS_TARGET static void BS_NAME(mix_columns)(BS_WORD *q) {
+	BS_WORD q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3], q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+	BS_WORD r0 = BS_ROTR16(q0), r1 = BS_ROTR16(q1), r2 = BS_ROTR16(q2), r3 = BS_ROTR16(q3);
+	BS_WORD r4 = BS_ROTR16(q4), r5 = BS_ROTR16(q5), r6 = BS_ROTR16(q6), r7 = BS_ROTR16(q7);
+	BS_WORD c7 = BS_XOR(q7, r7);
+
+	q[0] = BS_XOR(BS_XOR(c7, r0), BS_ROTR32(BS_XOR(q0, r0)));
+	q[1] = BS_XOR(BS_XOR(BS_XOR(q0, r0), BS_XOR(c7, r1)), BS_ROTR32(BS_XOR(q1, r1)));
+	q[2] = BS_XOR(BS_XOR(BS_XOR(q1, r1), r2), BS_ROTR32(BS_XOR(q2, r2)));
+	q[3] = BS_XOR(BS_XOR(BS_XOR(q2, r2), BS_XOR(c7, r3)), BS_ROTR32(BS_XOR(q3, r3)));
+	q[4] = BS_XOR(BS_XOR(BS_XOR(q3, r3), BS_XOR(c7, r4)), BS_ROTR32(BS_XOR(q4, r4)));
+	q[5] = BS_XOR(BS_XOR(BS_XOR(q4, r4), r5), BS_ROTR32(BS_XOR(q5, r5)));
+	q[6] = BS_XOR(BS_XOR(BS_XOR(q5, r5), r6), BS_ROTR32(BS_XOR(q6, r6)));
+	q[7] = BS_XOR(BS_XOR(BS_XOR(q6, r6), r7), BS_ROTR32(BS_XOR(q7, r7)));
+}
+
+/**
+ * InvMixColumns is MixColumns after multiplying each byte by 05 and
+ * adding 04 times the byte two rows along: a ^ 4 * (a ^ rotr32(a))
+**/
+BS_TARGET static void BS_NAME(inv_mix_columns)(BS_WORD *q) {
+	BS_WORD t[8];
+
+	for (int i = 0; i < 8; i++) {
+		t[i] = BS_XOR(q[i], BS_ROTR32(q[i]));
+	}
+	// 4 * t: planes move up two, bits 6 and 7 fold back through the polynomial
+	q[0] = BS_XOR(q[0], t[6]);
+	q[1] = BS_XOR(q[1], BS_XOR(t[6], t[7]));
+	q[2] = BS_XOR(q[2], BS_XOR(t[0], t[7]));
+	q[3] = BS_XOR(q[3], BS_XOR(t[1], t[6]));
+	q[4] = BS_XOR(q[4], BS_XOR(BS_XOR(t[2], t[6]), t[7]));
+	q[5] = BS_XOR(q[5], BS_XOR(t[3], t[7]));
+	q[6] = BS_XOR(q[6], t[4]);
+	q[7] = BS_XOR(q[7], t[5]);
+	BS_NAME(mix_columns)(q);
+}
+
+#undef BS_ROTR16
+
+// nr counts round keys, as ks->rounds does
+BS_TARGET static void BS_NAME(encrypt)(int nr, const uint64_t *sk, BS_WORD *q) {
+	BS_NAME(add_round_key)(q, sk);
+	for (int r = 1; r < nr - 1; r++) {
+		BS_NAME(sbox)(q);
+		BS_NAME(shift_rows)(q);
+		BS_NAME(mix_columns)(q);
+		BS_NAME(add_round_key)(q, sk + r * 8);
+	}
+	BS_NAME(sbox)(q);
+	BS_NAME(shift_rows)(q);
+	BS_NAME(add_round_key)(q, sk + (nr - 1) * 8);
+}
+
+// runs the encryption schedule backwards, so needs no dk
+BS_TARGET static void BS_NAME(decrypt)(int nr, const uint64_t *sk, BS_WORD *q) {
+	BS_NAME(add_round_key)(q, sk + (nr - 1) * 8);
+	for (int r = nr - 2; r > 0; r--) {
+		BS_NAME(inv_shift_rows)(q);
+		BS_NAME(inv_sbox)(q);
+		BS_NAME(add_round_key)(q, sk + r * 8);
+		BS_NAME(inv_mix_columns)(q);
+	}
+	BS_NAME(inv_shift_rows)(q);
+	BS_NAME(inv_sbox)(q);
+	BS_NAME(add_round_key)(q, sk);
+}
+
+/**
+ * Up to BS_BLOCKS blocks from in to out. A short batch is padded out and
+ * run in full, so the work done never depends on the data
+**/
+BS_TARGET static void BS_NAME(crypt_batch)(const key_schedule *ks, const unsigned char *in, unsigned char *out,
+		size_t n, int mode) {
+	uint64_t planes[8][BS_LANES];
+	BS_WORD q[8];
+	unsigned char buf[BS_BLOCKS * STATE_SIZE];
+	unsigned char *dst = out;
+
+	if (n < BS_BLOCKS) {
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, in, n * STATE_SIZE);
+		in = buf;
+		dst = buf;
+	}
+
+	for (size_t l = 0; l < BS_LANES; l++) {
+		for (int b = 0; b < 4; b++) {
+			bs_interleave_in(&planes[b][l], &planes[b + 4][l], in + (l * 4 + b) * STATE_SIZE);
+		}
+	}
+	for (int i = 0; i < 8; i++) {
+		memcpy(&q[i], planes[i], sizeof(BS_WORD));
+	}
+
+	BS_NAME(ortho)(q);
+	if (mode == ENCRYPT) {
+		BS_NAME(encrypt)(ks->rounds, ks->bk, q);
+	} else {
+		BS_NAME(decrypt)(ks->rounds, ks->bk, q);
+	}
+	BS_NAME(ortho)(q);
+
+	for (int i = 0; i < 8; i++) {
+		memcpy(planes[i], &q[i], sizeof(BS_WORD));
+	}
+	for (size_t l = 0; l < BS_LANES; l++) {
+		for (int b = 0; b < 4; b++) {
+			bs_interleave_out(dst + (l * 4 + b) * STATE_SIZE, planes[b][l], planes[b + 4][l]);
+		}
+	}
+
+	if (dst != out) {
+		memcpy(out, buf, n * STATE_SIZE);
+	}
+}
+
+BS_TARGET static void BS_NAME(encrypt_blocks)(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	while (blocks > 0) {
+		size_t n = blocks < BS_BLOCKS ? blocks : BS_BLOCKS;
+		BS_NAME(crypt_batch)(ks, in, out, n, ENCRYPT);
+		blocks -= n;
+		in += n * STATE_SIZE;
+		out += n * STATE_SIZE;
+	}
+}
+
+BS_TARGET static void BS_NAME(decrypt_blocks)(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	while (blocks > 0) {
+		size_t n = blocks < BS_BLOCKS ? blocks : BS_BLOCKS;
+		BS_NAME(crypt_batch)(ks, in, out, n, DECRYPT);
+		blocks -= n;
+		in += n * STATE_SIZE;
+		out += n * STATE_SIZE;
+	}
+}
+
+#undef BS_OR
+#undef BS_BLOCKS
+#undef BS_LANES
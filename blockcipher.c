@@ -1,559 +1,2035 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
-#include <stdio.h>
 #include <string.h>
-#include <errno.h>
-#include <limits.h>
-#include <assert.h>
 #include <stdlib.h>
-#include <ctype.h>
 
-#define KEY_SIZE   16 // key size in bytes
-#define STATE_SIZE 16 // state size in bytes
-#define ROUNDS     11 // 11 rounds correlate to the 16-byte (128-bit) key
-#define ENCRYPT    0
-#define DECRYPT    1
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "blockcipher_core.h"
+
+/**
+ * Per-module state, so every interpreter that imports blockcipher has its
+ * own backend choice and its own types. The pool, the usage counters and
+ * the cipher tables are process-wide underneath
+**/
+typedef struct {
+	const cipher_backend *backend; // the backend calls through this module run on
+	PyTypeObject *key_type;
+	PyTypeObject *stream_type;
+	PyTypeObject *keystream_type;
+	PyTypeObject *job_queue_type;
+} module_state;
+
+static module_state* get_state(PyObject *module) {
+	return PyModule_GetState(module);
+}
+
+// the state of the module that defined obj's type
+static module_state* type_state(PyObject *obj) {
+	return PyType_GetModuleState(Py_TYPE(obj));
+}
+
+// set_backend() may swap the backend mid-call, so a call loads it once and keeps that one
+static const cipher_backend* load_backend(module_state *st) {
+	return setting_load_ptr(st->backend);
+}
+
+/**
+ * Claims an object's busy flag for one call. Atomic, since without a GIL
+ * two threads can reach the same object at once
+**/
+static int claim(long *busy) {
+#if defined(_MSC_VER)
+	return _InterlockedCompareExchange((volatile long *)busy, 1, 0) == 0;
+#else
+	long idle = 0;
+	return __atomic_compare_exchange_n(busy, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+}
+
+static void unclaim(long *busy) {
+#if defined(_MSC_VER)
+	_InterlockedExchange((volatile long *)busy, 0);
+#else
+	__atomic_store_n(busy, 0, __ATOMIC_RELEASE);
+#endif
+}
 
 /**
- * All lookup tables from https://cryptography.fandom.com/wiki/Rijndael_mix_columns
-*/
-
-static const unsigned char s[256] = {
-	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
-
-static const unsigned char inv_s[256] = {
-	0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-	0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-	0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-	0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-	0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-	0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-	0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-	0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-	0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-	0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-	0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-	0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-	0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-	0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-	0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-	0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d};
-
-static const unsigned char rcon[255] = { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
-
-static const unsigned char galois_2[256] = {
-	0x00,0x02,0x04,0x06,0x08,0x0a,0x0c,0x0e,0x10,0x12,0x14,0x16,0x18,0x1a,0x1c,0x1e,
-	0x20,0x22,0x24,0x26,0x28,0x2a,0x2c,0x2e,0x30,0x32,0x34,0x36,0x38,0x3a,0x3c,0x3e,
-	0x40,0x42,0x44,0x46,0x48,0x4a,0x4c,0x4e,0x50,0x52,0x54,0x56,0x58,0x5a,0x5c,0x5e,
-	0x60,0x62,0x64,0x66,0x68,0x6a,0x6c,0x6e,0x70,0x72,0x74,0x76,0x78,0x7a,0x7c,0x7e,
-	0x80,0x82,0x84,0x86,0x88,0x8a,0x8c,0x8e,0x90,0x92,0x94,0x96,0x98,0x9a,0x9c,0x9e,
-	0xa0,0xa2,0xa4,0xa6,0xa8,0xaa,0xac,0xae,0xb0,0xb2,0xb4,0xb6,0xb8,0xba,0xbc,0xbe,
-	0xc0,0xc2,0xc4,0xc6,0xc8,0xca,0xcc,0xce,0xd0,0xd2,0xd4,0xd6,0xd8,0xda,0xdc,0xde,
-	0xe0,0xe2,0xe4,0xe6,0xe8,0xea,0xec,0xee,0xf0,0xf2,0xf4,0xf6,0xf8,0xfa,0xfc,0xfe,
-	0x1b,0x19,0x1f,0x1d,0x13,0x11,0x17,0x15,0x0b,0x09,0x0f,0x0d,0x03,0x01,0x07,0x05,
-	0x3b,0x39,0x3f,0x3d,0x33,0x31,0x37,0x35,0x2b,0x29,0x2f,0x2d,0x23,0x21,0x27,0x25,
-	0x5b,0x59,0x5f,0x5d,0x53,0x51,0x57,0x55,0x4b,0x49,0x4f,0x4d,0x43,0x41,0x47,0x45,
-	0x7b,0x79,0x7f,0x7d,0x73,0x71,0x77,0x75,0x6b,0x69,0x6f,0x6d,0x63,0x61,0x67,0x65,
-	0x9b,0x99,0x9f,0x9d,0x93,0x91,0x97,0x95,0x8b,0x89,0x8f,0x8d,0x83,0x81,0x87,0x85,
-	0xbb,0xb9,0xbf,0xbd,0xb3,0xb1,0xb7,0xb5,0xab,0xa9,0xaf,0xad,0xa3,0xa1,0xa7,0xa5,
-	0xdb,0xd9,0xdf,0xdd,0xd3,0xd1,0xd7,0xd5,0xcb,0xc9,0xcf,0xcd,0xc3,0xc1,0xc7,0xc5,
-	0xfb,0xf9,0xff,0xfd,0xf3,0xf1,0xf7,0xf5,0xeb,0xe9,0xef,0xed,0xe3,0xe1,0xe7,0xe5};
-
-static const unsigned char galois_3[256] = {
-	0x00,0x03,0x06,0x05,0x0c,0x0f,0x0a,0x09,0x18,0x1b,0x1e,0x1d,0x14,0x17,0x12,0x11,
-	0x30,0x33,0x36,0x35,0x3c,0x3f,0x3a,0x39,0x28,0x2b,0x2e,0x2d,0x24,0x27,0x22,0x21,
-	0x60,0x63,0x66,0x65,0x6c,0x6f,0x6a,0x69,0x78,0x7b,0x7e,0x7d,0x74,0x77,0x72,0x71,
-	0x50,0x53,0x56,0x55,0x5c,0x5f,0x5a,0x59,0x48,0x4b,0x4e,0x4d,0x44,0x47,0x42,0x41,
-	0xc0,0xc3,0xc6,0xc5,0xcc,0xcf,0xca,0xc9,0xd8,0xdb,0xde,0xdd,0xd4,0xd7,0xd2,0xd1,
-	0xf0,0xf3,0xf6,0xf5,0xfc,0xff,0xfa,0xf9,0xe8,0xeb,0xee,0xed,0xe4,0xe7,0xe2,0xe1,
-	0xa0,0xa3,0xa6,0xa5,0xac,0xaf,0xaa,0xa9,0xb8,0xbb,0xbe,0xbd,0xb4,0xb7,0xb2,0xb1,
-	0x90,0x93,0x96,0x95,0x9c,0x9f,0x9a,0x99,0x88,0x8b,0x8e,0x8d,0x84,0x87,0x82,0x81,
-	0x9b,0x98,0x9d,0x9e,0x97,0x94,0x91,0x92,0x83,0x80,0x85,0x86,0x8f,0x8c,0x89,0x8a,
-	0xab,0xa8,0xad,0xae,0xa7,0xa4,0xa1,0xa2,0xb3,0xb0,0xb5,0xb6,0xbf,0xbc,0xb9,0xba,
-	0xfb,0xf8,0xfd,0xfe,0xf7,0xf4,0xf1,0xf2,0xe3,0xe0,0xe5,0xe6,0xef,0xec,0xe9,0xea,
-	0xcb,0xc8,0xcd,0xce,0xc7,0xc4,0xc1,0xc2,0xd3,0xd0,0xd5,0xd6,0xdf,0xdc,0xd9,0xda,
-	0x5b,0x58,0x5d,0x5e,0x57,0x54,0x51,0x52,0x43,0x40,0x45,0x46,0x4f,0x4c,0x49,0x4a,
-	0x6b,0x68,0x6d,0x6e,0x67,0x64,0x61,0x62,0x73,0x70,0x75,0x76,0x7f,0x7c,0x79,0x7a,
-	0x3b,0x38,0x3d,0x3e,0x37,0x34,0x31,0x32,0x23,0x20,0x25,0x26,0x2f,0x2c,0x29,0x2a,
-	0x0b,0x08,0x0d,0x0e,0x07,0x04,0x01,0x02,0x13,0x10,0x15,0x16,0x1f,0x1c,0x19,0x1a};
-
-static const unsigned char galois_9[256] = {
-	0x00,0x09,0x12,0x1b,0x24,0x2d,0x36,0x3f,0x48,0x41,0x5a,0x53,0x6c,0x65,0x7e,0x77,
-	0x90,0x99,0x82,0x8b,0xb4,0xbd,0xa6,0xaf,0xd8,0xd1,0xca,0xc3,0xfc,0xf5,0xee,0xe7,
-	0x3b,0x32,0x29,0x20,0x1f,0x16,0x0d,0x04,0x73,0x7a,0x61,0x68,0x57,0x5e,0x45,0x4c,
-	0xab,0xa2,0xb9,0xb0,0x8f,0x86,0x9d,0x94,0xe3,0xea,0xf1,0xf8,0xc7,0xce,0xd5,0xdc,
-	0x76,0x7f,0x64,0x6d,0x52,0x5b,0x40,0x49,0x3e,0x37,0x2c,0x25,0x1a,0x13,0x08,0x01,
-	0xe6,0xef,0xf4,0xfd,0xc2,0xcb,0xd0,0xd9,0xae,0xa7,0xbc,0xb5,0x8a,0x83,0x98,0x91,
-	0x4d,0x44,0x5f,0x56,0x69,0x60,0x7b,0x72,0x05,0x0c,0x17,0x1e,0x21,0x28,0x33,0x3a,
-	0xdd,0xd4,0xcf,0xc6,0xf9,0xf0,0xeb,0xe2,0x95,0x9c,0x87,0x8e,0xb1,0xb8,0xa3,0xaa,
-	0xec,0xe5,0xfe,0xf7,0xc8,0xc1,0xda,0xd3,0xa4,0xad,0xb6,0xbf,0x80,0x89,0x92,0x9b,
-	0x7c,0x75,0x6e,0x67,0x58,0x51,0x4a,0x43,0x34,0x3d,0x26,0x2f,0x10,0x19,0x02,0x0b,
-	0xd7,0xde,0xc5,0xcc,0xf3,0xfa,0xe1,0xe8,0x9f,0x96,0x8d,0x84,0xbb,0xb2,0xa9,0xa0,
-	0x47,0x4e,0x55,0x5c,0x63,0x6a,0x71,0x78,0x0f,0x06,0x1d,0x14,0x2b,0x22,0x39,0x30,
-	0x9a,0x93,0x88,0x81,0xbe,0xb7,0xac,0xa5,0xd2,0xdb,0xc0,0xc9,0xf6,0xff,0xe4,0xed,
-	0x0a,0x03,0x18,0x11,0x2e,0x27,0x3c,0x35,0x42,0x4b,0x50,0x59,0x66,0x6f,0x74,0x7d,
-	0xa1,0xa8,0xb3,0xba,0x85,0x8c,0x97,0x9e,0xe9,0xe0,0xfb,0xf2,0xcd,0xc4,0xdf,0xd6,
-	0x31,0x38,0x23,0x2a,0x15,0x1c,0x07,0x0e,0x79,0x70,0x6b,0x62,0x5d,0x54,0x4f,0x46};
-
-static const unsigned char galois_b[256] = {
-	0x00,0x0b,0x16,0x1d,0x2c,0x27,0x3a,0x31,0x58,0x53,0x4e,0x45,0x74,0x7f,0x62,0x69,
-	0xb0,0xbb,0xa6,0xad,0x9c,0x97,0x8a,0x81,0xe8,0xe3,0xfe,0xf5,0xc4,0xcf,0xd2,0xd9,
-	0x7b,0x70,0x6d,0x66,0x57,0x5c,0x41,0x4a,0x23,0x28,0x35,0x3e,0x0f,0x04,0x19,0x12,
-	0xcb,0xc0,0xdd,0xd6,0xe7,0xec,0xf1,0xfa,0x93,0x98,0x85,0x8e,0xbf,0xb4,0xa9,0xa2,
-	0xf6,0xfd,0xe0,0xeb,0xda,0xd1,0xcc,0xc7,0xae,0xa5,0xb8,0xb3,0x82,0x89,0x94,0x9f,
-	0x46,0x4d,0x50,0x5b,0x6a,0x61,0x7c,0x77,0x1e,0x15,0x08,0x03,0x32,0x39,0x24,0x2f,
-	0x8d,0x86,0x9b,0x90,0xa1,0xaa,0xb7,0xbc,0xd5,0xde,0xc3,0xc8,0xf9,0xf2,0xef,0xe4,
-	0x3d,0x36,0x2b,0x20,0x11,0x1a,0x07,0x0c,0x65,0x6e,0x73,0x78,0x49,0x42,0x5f,0x54,
-	0xf7,0xfc,0xe1,0xea,0xdb,0xd0,0xcd,0xc6,0xaf,0xa4,0xb9,0xb2,0x83,0x88,0x95,0x9e,
-	0x47,0x4c,0x51,0x5a,0x6b,0x60,0x7d,0x76,0x1f,0x14,0x09,0x02,0x33,0x38,0x25,0x2e,
-	0x8c,0x87,0x9a,0x91,0xa0,0xab,0xb6,0xbd,0xd4,0xdf,0xc2,0xc9,0xf8,0xf3,0xee,0xe5,
-	0x3c,0x37,0x2a,0x21,0x10,0x1b,0x06,0x0d,0x64,0x6f,0x72,0x79,0x48,0x43,0x5e,0x55,
-	0x01,0x0a,0x17,0x1c,0x2d,0x26,0x3b,0x30,0x59,0x52,0x4f,0x44,0x75,0x7e,0x63,0x68,
-	0xb1,0xba,0xa7,0xac,0x9d,0x96,0x8b,0x80,0xe9,0xe2,0xff,0xf4,0xc5,0xce,0xd3,0xd8,
-	0x7a,0x71,0x6c,0x67,0x56,0x5d,0x40,0x4b,0x22,0x29,0x34,0x3f,0x0e,0x05,0x18,0x13,
-	0xca,0xc1,0xdc,0xd7,0xe6,0xed,0xf0,0xfb,0x92,0x99,0x84,0x8f,0xbe,0xb5,0xa8,0xa3};
-
-static const unsigned char galois_d[256] = {
-	0x00,0x0d,0x1a,0x17,0x34,0x39,0x2e,0x23,0x68,0x65,0x72,0x7f,0x5c,0x51,0x46,0x4b,
-	0xd0,0xdd,0xca,0xc7,0xe4,0xe9,0xfe,0xf3,0xb8,0xb5,0xa2,0xaf,0x8c,0x81,0x96,0x9b,
-	0xbb,0xb6,0xa1,0xac,0x8f,0x82,0x95,0x98,0xd3,0xde,0xc9,0xc4,0xe7,0xea,0xfd,0xf0,
-	0x6b,0x66,0x71,0x7c,0x5f,0x52,0x45,0x48,0x03,0x0e,0x19,0x14,0x37,0x3a,0x2d,0x20,
-	0x6d,0x60,0x77,0x7a,0x59,0x54,0x43,0x4e,0x05,0x08,0x1f,0x12,0x31,0x3c,0x2b,0x26,
-	0xbd,0xb0,0xa7,0xaa,0x89,0x84,0x93,0x9e,0xd5,0xd8,0xcf,0xc2,0xe1,0xec,0xfb,0xf6,
-	0xd6,0xdb,0xcc,0xc1,0xe2,0xef,0xf8,0xf5,0xbe,0xb3,0xa4,0xa9,0x8a,0x87,0x90,0x9d,
-	0x06,0x0b,0x1c,0x11,0x32,0x3f,0x28,0x25,0x6e,0x63,0x74,0x79,0x5a,0x57,0x40,0x4d,
-	0xda,0xd7,0xc0,0xcd,0xee,0xe3,0xf4,0xf9,0xb2,0xbf,0xa8,0xa5,0x86,0x8b,0x9c,0x91,
-	0x0a,0x07,0x10,0x1d,0x3e,0x33,0x24,0x29,0x62,0x6f,0x78,0x75,0x56,0x5b,0x4c,0x41,
-	0x61,0x6c,0x7b,0x76,0x55,0x58,0x4f,0x42,0x09,0x04,0x13,0x1e,0x3d,0x30,0x27,0x2a,
-	0xb1,0xbc,0xab,0xa6,0x85,0x88,0x9f,0x92,0xd9,0xd4,0xc3,0xce,0xed,0xe0,0xf7,0xfa,
-	0xb7,0xba,0xad,0xa0,0x83,0x8e,0x99,0x94,0xdf,0xd2,0xc5,0xc8,0xeb,0xe6,0xf1,0xfc,
-	0x67,0x6a,0x7d,0x70,0x53,0x5e,0x49,0x44,0x0f,0x02,0x15,0x18,0x3b,0x36,0x21,0x2c,
-	0x0c,0x01,0x16,0x1b,0x38,0x35,0x22,0x2f,0x64,0x69,0x7e,0x73,0x50,0x5d,0x4a,0x47,
-	0xdc,0xd1,0xc6,0xcb,0xe8,0xe5,0xf2,0xff,0xb4,0xb9,0xae,0xa3,0x80,0x8d,0x9a,0x97};
-
-static const unsigned char galois_e[256] = {
-	0x00,0x0e,0x1c,0x12,0x38,0x36,0x24,0x2a,0x70,0x7e,0x6c,0x62,0x48,0x46,0x54,0x5a,
-	0xe0,0xee,0xfc,0xf2,0xd8,0xd6,0xc4,0xca,0x90,0x9e,0x8c,0x82,0xa8,0xa6,0xb4,0xba,
-	0xdb,0xd5,0xc7,0xc9,0xe3,0xed,0xff,0xf1,0xab,0xa5,0xb7,0xb9,0x93,0x9d,0x8f,0x81,
-	0x3b,0x35,0x27,0x29,0x03,0x0d,0x1f,0x11,0x4b,0x45,0x57,0x59,0x73,0x7d,0x6f,0x61,
-	0xad,0xa3,0xb1,0xbf,0x95,0x9b,0x89,0x87,0xdd,0xd3,0xc1,0xcf,0xe5,0xeb,0xf9,0xf7,
-	0x4d,0x43,0x51,0x5f,0x75,0x7b,0x69,0x67,0x3d,0x33,0x21,0x2f,0x05,0x0b,0x19,0x17,
-	0x76,0x78,0x6a,0x64,0x4e,0x40,0x52,0x5c,0x06,0x08,0x1a,0x14,0x3e,0x30,0x22,0x2c,
-	0x96,0x98,0x8a,0x84,0xae,0xa0,0xb2,0xbc,0xe6,0xe8,0xfa,0xf4,0xde,0xd0,0xc2,0xcc,
-	0x41,0x4f,0x5d,0x53,0x79,0x77,0x65,0x6b,0x31,0x3f,0x2d,0x23,0x09,0x07,0x15,0x1b,
-	0xa1,0xaf,0xbd,0xb3,0x99,0x97,0x85,0x8b,0xd1,0xdf,0xcd,0xc3,0xe9,0xe7,0xf5,0xfb,
-	0x9a,0x94,0x86,0x88,0xa2,0xac,0xbe,0xb0,0xea,0xe4,0xf6,0xf8,0xd2,0xdc,0xce,0xc0,
-	0x7a,0x74,0x66,0x68,0x42,0x4c,0x5e,0x50,0x0a,0x04,0x16,0x18,0x32,0x3c,0x2e,0x20,
-	0xec,0xe2,0xf0,0xfe,0xd4,0xda,0xc8,0xc6,0x9c,0x92,0x80,0x8e,0xa4,0xaa,0xb8,0xb6,
-	0x0c,0x02,0x10,0x1e,0x34,0x3a,0x28,0x26,0x7c,0x72,0x60,0x6e,0x44,0x4a,0x58,0x56,
-	0x37,0x39,0x2b,0x25,0x0f,0x01,0x13,0x1d,0x47,0x49,0x5b,0x55,0x7f,0x71,0x63,0x6d,
-	0xd7,0xd9,0xcb,0xc5,0xef,0xe1,0xf3,0xfd,0xa7,0xa9,0xbb,0xb5,0x9f,0x91,0x83,0x8d};
-
-void pretty_print(unsigned char *in, int bytes) {
-	for (int i = 0; i < bytes; i += 16) {
-		printf("%02x %02x %02x %02x\n%02x %02x %02x %02x\n%02x %02x %02x %02x\n%02x %02x %02x %02x\n",
-		in[i+0x0], in[i+0x1], in[i+0x2], in[i+0x3], in[i+0x4], in[i+0x5], in[i+0x6], in[i+0x7],
-		in[i+0x8], in[i+0x9], in[i+0xa], in[i+0xb], in[i+0xc], in[i+0xd], in[i+0xe], in[i+0xf]);
-	}
-}
-
-void pretty_print_decimal(unsigned char *in, int bytes) {
-	for (int i = 0; i < bytes; i += 16) {
-		printf("%03d %03d %03d %03d\n%03d %03d %03d %03d\n%03d %03d %03d %03d\n%03d %03d %03d %03d\n",
-		in[i+0x0], in[i+0x1], in[i+0x2], in[i+0x3], in[i+0x4], in[i+0x5], in[i+0x6], in[i+0x7],
-		in[i+0x8], in[i+0x9], in[i+0xa], in[i+0xb], in[i+0xc], in[i+0xd], in[i+0xe], in[i+0xf]);
+ * blockcipher.Key, a key whose schedule is expanded once on construction.
+ * The decryption schedule is built then too, in constant time whichever
+ * backend is selected, and __init__ runs only once, so a Key is never
+ * written afterwards and any number of threads may share it
+**/
+typedef struct {
+	PyObject_HEAD
+	key_schedule ks;
+	long initialized; // claimed by the one __init__ that builds ks
+} KeyObject;
+
+static int Key_init(KeyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = { "key", NULL };
+	Py_buffer key_buf;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*", kwlist, &key_buf)) {
+		return -1;
 	}
+
+	if (rounds_for_key((int)key_buf.len) == 0) {
+		PyBuffer_Release(&key_buf);
+		PyErr_SetString(PyExc_ValueError, "key must be 16, 24 or 32 bytes");
+		return -1;
+	}
+	if (!claim(&self->initialized)) {
+		PyBuffer_Release(&key_buf);
+		PyErr_SetString(PyExc_RuntimeError, "Key is already initialized");
+		return -1;
+	}
+
+	const cipher_backend *be = load_backend(type_state((PyObject *)self));
+	schedule_key(be, (unsigned char *)key_buf.buf, (int)key_buf.len, &self->ks);
+	prepare_decrypt(be, &self->ks);
+	PyBuffer_Release(&key_buf);
+	return 0;
+}
+
+static PyObject* Key_get_key_size(KeyObject *self, void *closure) {
+	return PyLong_FromLong(self->ks.key_size);
+}
+
+static PyGetSetDef Key_getset[] = {
+	{ "key_size", (getter)Key_get_key_size, NULL, "key length in bytes: 16, 24 or 32", NULL },
+	{ NULL }
+};
+
+// heap type instances hold a reference to their type
+static void heap_dealloc(PyObject *self) {
+	PyTypeObject *tp = Py_TYPE(self);
+	tp->tp_free(self);
+	Py_DECREF(tp);
 }
 
+static PyType_Slot Key_slots[] = {
+	{ Py_tp_doc, "Key(key) -> expanded key schedule for a 16, 24 or 32-byte key, reusable across calls" },
+	{ Py_tp_getset, Key_getset },
+	{ Py_tp_new, PyType_GenericNew },
+	{ Py_tp_init, Key_init },
+	{ Py_tp_dealloc, heap_dealloc },
+	{ 0, NULL }
+};
+
+static PyType_Spec Key_spec = {
+	"blockcipher.Key", sizeof(KeyObject), 0, Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE, Key_slots
+};
+
 /**
- * XOR's word, a, with word, b, and stores it in res
+ * Resolves a key argument: a Key object is used as-is, raw key bytes or the
+ * legacy list of ints are expanded into scratch. Returns NULL with
+ * an exception set on a bad key
 **/
-static void xor(unsigned char *a, unsigned char *b, unsigned char* res) {
-	res[0] = a[0] ^ b[0];
-	res[1] = a[1] ^ b[1];
-	res[2] = a[2] ^ b[2];
-	res[3] = a[3] ^ b[3];
-}
-
-static void g(unsigned char *in, unsigned char *res, int r) {
-	// left circular shift
-	res[0] = in[1];
-	res[1] = in[2];
-	res[2] = in[3];
-	res[3] = in[0];
-
-	// byte substition
-	res[0] = s[((res[0]>>4)*16) + (res[0]&0xf)];
-	res[1] = s[((res[1]>>4)*16) + (res[1]&0xf)];
-	res[2] = s[((res[2]>>4)*16) + (res[2]&0xf)];
-	res[3] = s[((res[3]>>4)*16) + (res[3]&0xf)];
-
-	// xor with rcon
-	res[0] ^= rcon[r];
-}
-
-static void generate_round_keys(unsigned char *key, unsigned char *round_keys) {
-	int i = 0;  // i corresponds to the current word
-				// floor(i/4) corresponds to current round
-
-	/**
-	 * copying the key into the first round
-	**/
-
-	// KEY_SIZE / 4 because there are 4 bytes per word
-	while(i < KEY_SIZE / 4) {
-		round_keys[(i*4)+0] = key[(i*4)+0];
-		round_keys[(i*4)+1] = key[(i*4)+1];
-		round_keys[(i*4)+2] = key[(i*4)+2];
-		round_keys[(i*4)+3] = key[(i*4)+3];
-		i += 1;
-	}
-
-	/**
-	 * generating the next 10 rounds
-	**/
-
-	// current 4 words in rotation
-	unsigned char w_0[4];
-	unsigned char w_1[4];
-	unsigned char w_2[4];
-	unsigned char w_3[4];
-
-	// next 4 words to generate
-	unsigned char w_4[4];
-	unsigned char w_5[4];
-	unsigned char w_6[4];
-	unsigned char w_7[4];
-
-	// result of g()
-	unsigned char g_r[4];
-
-	// advance until all 11 rounds filled,
-	// ROUNDS - 1 because we generate the NEXT round using the current round
-	// KEY_SIZE/4 again because words, not bytes
-	while (i <= (ROUNDS - 1) * KEY_SIZE/4) {
-		// copy previous 4 words into current
-		w_0[0] = round_keys[((i-4)*4)+0];
-		w_1[0] = round_keys[((i-4)*4)+1];
-		w_2[0] = round_keys[((i-4)*4)+2];
-		w_3[0] = round_keys[((i-4)*4)+3];
-
-		w_0[1] = round_keys[((i-3)*4)+0];
-		w_1[1] = round_keys[((i-3)*4)+1];
-		w_2[1] = round_keys[((i-3)*4)+2];
-		w_3[1] = round_keys[((i-3)*4)+3];
-
-		w_0[2] = round_keys[((i-2)*4)+0];
-		w_1[2] = round_keys[((i-2)*4)+1];
-		w_2[2] = round_keys[((i-2)*4)+2];
-		w_3[2] = round_keys[((i-2)*4)+3];
-
-		w_0[3] = round_keys[((i-1)*4)+0];
-		w_1[3] = round_keys[((i-1)*4)+1];
-		w_2[3] = round_keys[((i-1)*4)+2];
-		w_3[3] = round_keys[((i-1)*4)+3];
-
-		round_keys[((i+0)*4)+0] = w_0[0];
-		round_keys[((i+0)*4)+1] = w_1[0];
-		round_keys[((i+0)*4)+2] = w_2[0];
-		round_keys[((i+0)*4)+3] = w_3[0];
-
-		round_keys[((i+1)*4)+0] = w_0[1];
-		round_keys[((i+1)*4)+1] = w_1[1];
-		round_keys[((i+1)*4)+2] = w_2[1];
-		round_keys[((i+1)*4)+3] = w_3[1];
-
-		round_keys[((i+2)*4)+0] = w_0[2];
-		round_keys[((i+2)*4)+1] = w_1[2];
-		round_keys[((i+2)*4)+2] = w_2[2];
-		round_keys[((i+2)*4)+3] = w_3[2];
-
-		round_keys[((i+3)*4)+0] = w_0[3];
-		round_keys[((i+3)*4)+1] = w_1[3];
-		round_keys[((i+3)*4)+2] = w_2[3];
-		round_keys[((i+3)*4)+3] = w_3[3];
+static key_schedule* get_key_schedule(module_state *st, const cipher_backend *be, PyObject *key_obj, key_schedule *scratch) {
+	unsigned char key[MAX_KEY_SIZE];
+	int key_size;
+
+	if (PyObject_TypeCheck(key_obj, st->key_type)) {
+		return &((KeyObject *)key_obj)->ks;
+	}
 
-		// (i/4) because g() requires the current round,
-		// i corresponds to the current word, four words per round
-		g(w_3, g_r, (i/4));
-
-		xor(g_r, w_0, w_4);
-		xor(w_4, w_1, w_5);
-		xor(w_5, w_2, w_6);
-		xor(w_6, w_3, w_7);
+	if (PyObject_CheckBuffer(key_obj)) {
+		Py_buffer key_buf;
+		if (PyObject_GetBuffer(key_obj, &key_buf, PyBUF_SIMPLE) < 0) {
+			return NULL;
+		}
+		if (rounds_for_key((int)key_buf.len) == 0) {
+			PyBuffer_Release(&key_buf);
+			PyErr_SetString(PyExc_ValueError, "key must be 16, 24 or 32 bytes");
+			return NULL;
+		}
+		key_size = (int)key_buf.len;
+		memcpy(key, key_buf.buf, key_size);
+		PyBuffer_Release(&key_buf);
+
+		schedule_key(be, key, key_size, scratch);
+		return scratch;
+	}
 
-		round_keys[((i+0)*4)+0] = w_4[0];
-		round_keys[((i+0)*4)+1] = w_5[0];
-		round_keys[((i+0)*4)+2] = w_6[0];
-		round_keys[((i+0)*4)+3] = w_7[0];
+	if (!PyList_CheckExact(key_obj) || rounds_for_key((int)PyList_Size(key_obj)) == 0) {
+		PyErr_SetString(PyExc_TypeError, "key must be a blockcipher.Key, 16, 24 or 32 bytes or a list of as many ints");
+		return NULL;
+	}
 
-		round_keys[((i+1)*4)+0] = w_4[1];
-		round_keys[((i+1)*4)+1] = w_5[1];
-		round_keys[((i+1)*4)+2] = w_6[1];
-		round_keys[((i+1)*4)+3] = w_7[1];
-
-		round_keys[((i+2)*4)+0] = w_4[2];
-		round_keys[((i+2)*4)+1] = w_5[2];
-		round_keys[((i+2)*4)+2] = w_6[2];
-		round_keys[((i+2)*4)+3] = w_7[2];
-
-		round_keys[((i+3)*4)+0] = w_4[3];
-		round_keys[((i+3)*4)+1] = w_5[3];
-		round_keys[((i+3)*4)+2] = w_6[3];
-		round_keys[((i+3)*4)+3] = w_7[3];
-
-		i += 4;
-	}
+	key_size = (int)PyList_Size(key_obj);
+	for (int i = 0; i < key_size; i++) {
+		key[i] = (unsigned char)PyLong_AsLong(PyList_GetItem(key_obj, i));
+	}
+	if (PyErr_Occurred()) {
+		return NULL;
+	}
 
+	schedule_key(be, key, key_size, scratch);
+	return scratch;
 }
 
-static void add_round_key(unsigned char *state, unsigned char *round_keys, int round) {
+static PyObject* blockcipher(PyObject* self, PyObject* args) {
+	PyObject* key_obj;
+	PyObject* in_list;
+	int mode_in;
+
+	if (!PyArg_ParseTuple(args, "OOi", &key_obj, &in_list, &mode_in)) {
+		return NULL;
+	}
+
+	if (!PyList_CheckExact(in_list)) {
+		PyErr_SetString(PyExc_TypeError, "blockcipher handed something not a list");
+		return NULL;
+	}
+
+	int in_size = (int)PyList_Size(in_list);
+
+	if (in_size != STATE_SIZE) {
+		PyErr_SetString(PyExc_ValueError, "blockcipher handed list with invalid size");
+		return NULL;
+	}
+
+	module_state *st = get_state(self);
+	const cipher_backend *be = load_backend(st);
+	key_schedule scratch;
+	key_schedule *ks = get_key_schedule(st, be, key_obj, &scratch);
+	if (ks == NULL) {
+		return NULL;
+	}
 
-	int round_offset = round<<4;
+	unsigned char input[STATE_SIZE];
+	unsigned char output[STATE_SIZE];
 
 	for (int i = 0; i < STATE_SIZE; i++) {
-		state[i] ^= round_keys[round_offset + i];
+		input[i] = (unsigned char)PyLong_AsLong(PyList_GetItem(in_list, i));
 	}
-}
 
-static void sub_bytes(unsigned char *state) {
+	uint64_t start = stats_start();
+	if (mode_in == ENCRYPT) {
+		be->encrypt(ks, input, output);
+	} else if (mode_in == DECRYPT) {
+		prepare_decrypt(be, ks);
+		be->decrypt(ks, input, output);
+	} else {
+		PyErr_SetString(PyExc_ValueError, "INVALID ENCRYPT/DECRYPT MODE");
+		return NULL;
+	}
+	stats_record(be, MODE_ECB, mode_in, STATE_SIZE, start);
+
+	PyObject* out_list = PyList_New(STATE_SIZE);
 	for (int i = 0; i < STATE_SIZE; i++) {
-		state[i] = s[(state[i]&0xf0) + (state[i]&0xf)];
+		PyList_SetItem(out_list, i, PyLong_FromLong((long)output[i]));
 	}
+
+	return out_list;
 }
 
-static void inv_sub_bytes(unsigned char *state) {
-	for (int i = 0; i < STATE_SIZE; i++) {
-		state[i] = inv_s[(state[i]&0xf0) + (state[i]&0xf)];
+/**
+ * Runs mode mode_id over the whole blocks in the first `length` bytes of in. Returns a
+ * new bytes object, or writes into out_obj and returns the number of bytes
+ * written. Trailing bytes short of a block are dropped, as in AES.py
+**/
+static PyObject* run_mode(module_state *st, PyObject *key_obj, const unsigned char *iv, Py_buffer *in_buf,
+		Py_ssize_t length, PyObject *out_obj, int mode_id, int mode) {
+	if (length < 0) {
+		length = in_buf->len;
+	} else if (length > in_buf->len) {
+		PyErr_SetString(PyExc_ValueError, "length is larger than data");
+		return NULL;
+	}
+
+	if (mode != ENCRYPT && mode != DECRYPT) {
+		PyErr_SetString(PyExc_ValueError, "mode_in MUST be 0(encrypt) or 1(decrypt)");
+		return NULL;
+	}
+
+	const cipher_backend *be = load_backend(st);
+	key_schedule scratch;
+	key_schedule *ks = get_key_schedule(st, be, key_obj, &scratch);
+	if (ks == NULL) {
+		return NULL;
 	}
+	if (mode == DECRYPT && modes[mode_id].uses_inverse) {
+		prepare_decrypt(be, ks);
+	}
+
+	size_t blocks = (size_t)length / STATE_SIZE;
+	Py_ssize_t out_len = (Py_ssize_t)(blocks * STATE_SIZE);
+
+	if (out_obj == NULL || out_obj == Py_None) {
+		PyObject *result = PyBytes_FromStringAndSize(NULL, out_len);
+		if (result != NULL) {
+			unsigned char *out = (unsigned char *)PyBytes_AS_STRING(result);
+			Py_BEGIN_ALLOW_THREADS
+			uint64_t start = stats_start();
+			crypt_mode(be, ks, mode_id, iv, in_buf->buf, out, blocks, mode);
+			stats_record(be, mode_id, mode, (size_t)out_len, start);
+			Py_END_ALLOW_THREADS
+		}
+		return result;
+	}
+
+	Py_buffer out_buf;
+	if (PyObject_GetBuffer(out_obj, &out_buf, PyBUF_WRITABLE) < 0) {
+		return NULL;
+	}
+	if (out_buf.len < out_len) {
+		PyBuffer_Release(&out_buf);
+		PyErr_SetString(PyExc_ValueError, "out is smaller than the data to process");
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	uint64_t start = stats_start();
+	crypt_mode(be, ks, mode_id, iv, in_buf->buf, out_buf.buf, blocks, mode);
+	stats_record(be, mode_id, mode, (size_t)out_len, start);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&out_buf);
+	return PyLong_FromSsize_t(out_len);
 }
 
-static void shift_rows(unsigned char *state) {
-	unsigned char swap;
+static PyObject* bulk_crypt(module_state *st, PyObject *args, PyObject *kwds, int mode) {
+	static char *kwlist[] = { "key", "data", "length", "out", NULL };
+	PyObject *key_obj;
+	Py_buffer in_buf;
+	Py_ssize_t length = -1;
+	PyObject *out_obj = NULL;
 
-	swap = state[4];
-	state[4] = state[5];
-	state[5] = state[6];
-	state[6] = state[7];
-	state[7] = swap;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*|nO", kwlist, &key_obj, &in_buf, &length, &out_obj)) {
+		return NULL;
+	}
+
+	PyObject *result = run_mode(st, key_obj, NULL, &in_buf, length, out_obj, MODE_ECB, mode);
+	PyBuffer_Release(&in_buf);
+	return result;
+}
 
-	swap = state[8];
-	state[ 8] = state[10];
-	state[10] = swap;
-	swap = state[9];
-	state[ 9] = state[11];
-	state[11] = swap;
+static PyObject* bulk_encrypt(PyObject* self, PyObject* args, PyObject* kwds) {
+	return bulk_crypt(get_state(self), args, kwds, ENCRYPT);
+}
 
-	swap = state[12];
-	state[12] = state[15];
-	state[15] = state[14];
-	state[14] = state[13];
-	state[13] = swap;
+static PyObject* bulk_decrypt(PyObject* self, PyObject* args, PyObject* kwds) {
+	return bulk_crypt(get_state(self), args, kwds, DECRYPT);
 }
 
-static void inv_shift_rows(unsigned char *state) {
-	unsigned char swap;
+static PyObject* ecb(PyObject* self, PyObject* args, PyObject* kwds) {
+	static char *kwlist[] = { "key", "data", "mode", "out", NULL };
+	PyObject *key_obj;
+	Py_buffer in_buf;
+	int mode;
+	PyObject *out_obj = NULL;
 
-	swap = state[4];
-	state[4] = state[7];
-	state[7] = state[6];
-	state[6] = state[5];
-	state[5] = swap;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*i|O", kwlist, &key_obj, &in_buf, &mode, &out_obj)) {
+		return NULL;
+	}
 
-	swap = state[8];
-	state[ 8] = state[10];
-	state[10] = swap;
-	swap = state[9];
-	state[ 9] = state[11];
-	state[11] = swap;
+	PyObject *result = run_mode(get_state(self), key_obj, NULL, &in_buf, -1, out_obj, MODE_ECB, mode);
+	PyBuffer_Release(&in_buf);
+	return result;
+}
 
-	swap = state[12];
-	state[12] = state[13];
-	state[13] = state[14];
-	state[14] = state[15];
-	state[15] = swap;
+/**
+ * Shared body of the modes that take a 16-byte iv
+**/
+static PyObject* iv_mode(module_state *st, PyObject *args, PyObject *kwds, int mode_id) {
+	static char *kwlist[] = { "key", "iv", "data", "mode", "out", NULL };
+	PyObject *key_obj;
+	Py_buffer iv_buf;
+	Py_buffer in_buf;
+	int mode;
+	PyObject *out_obj = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*y*i|O", kwlist, &key_obj, &iv_buf, &in_buf, &mode, &out_obj)) {
+		return NULL;
+	}
+
+	PyObject *result = NULL;
+	if (iv_buf.len != STATE_SIZE) {
+		PyErr_Format(PyExc_ValueError, "iv must be %d bytes", STATE_SIZE);
+	} else {
+		result = run_mode(st, key_obj, iv_buf.buf, &in_buf, -1, out_obj, mode_id, mode);
+	}
+
+	PyBuffer_Release(&iv_buf);
+	PyBuffer_Release(&in_buf);
+	return result;
+}
+
+static PyObject* cbc(PyObject* self, PyObject* args, PyObject* kwds) {
+	return iv_mode(get_state(self), args, kwds, MODE_CBC);
+}
+
+static PyObject* pcbc(PyObject* self, PyObject* args, PyObject* kwds) {
+	return iv_mode(get_state(self), args, kwds, MODE_PCBC);
+}
+
+static PyObject* cfb(PyObject* self, PyObject* args, PyObject* kwds) {
+	return iv_mode(get_state(self), args, kwds, MODE_CFB);
+}
+
+static PyObject* ofb(PyObject* self, PyObject* args, PyObject* kwds) {
+	return iv_mode(get_state(self), args, kwds, MODE_OFB);
+}
+
+static PyObject* ctr(PyObject* self, PyObject* args, PyObject* kwds) {
+	static char *kwlist[] = { "key", "nonce", "data", "mode", "out", NULL };
+	PyObject *key_obj;
+	unsigned long long nonce;
+	Py_buffer in_buf;
+	int mode;
+	PyObject *out_obj = NULL;
+
+	// 'K' keeps the low 64 bits, same as AES.ctr's nonce_in & 0xffffffffffffffff
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OKy*i|O", kwlist, &key_obj, &nonce, &in_buf, &mode, &out_obj)) {
+		return NULL;
+	}
+
+	unsigned char counter[STATE_SIZE];
+	nonce_counter_block(nonce, counter);
+
+	PyObject *result = run_mode(get_state(self), key_obj, counter, &in_buf, -1, out_obj, MODE_CTR, mode);
+	PyBuffer_Release(&in_buf);
+	return result;
+}
+
+/**
+ * gcm_encrypt/gcm_decrypt: AES-GCM as in NIST SP 800-38D. The key is in
+ * the module's byte order like every other key; iv, data, aad and tag are
+ * the standard byte strings, so they interoperate with any other AES-GCM
+**/
+
+// parses the GCM key, iv and aad and checks the lengths; the caller releases the buffers
+static key_schedule* gcm_args(module_state *st, const cipher_backend *be, PyObject *key_obj, key_schedule *scratch,
+		Py_buffer *iv_buf, Py_buffer *in_buf) {
+	if (iv_buf->len != GCM_IV_SIZE) {
+		PyErr_Format(PyExc_ValueError, "iv must be %d bytes", GCM_IV_SIZE);
+		return NULL;
+	}
+	if ((uint64_t)in_buf->len > GCM_MAX_DATA) {
+		PyErr_SetString(PyExc_OverflowError, "data is too long for one GCM message");
+		return NULL;
+	}
+	return get_key_schedule(st, be, key_obj, scratch);
 }
 
-// mix columns algorithm from https://cryptography.fandom.com/wiki/Rijndael_mix_columns
-static void mix_columns(unsigned char *state) {
-	unsigned char a[4];
+static PyObject* gcm_encrypt(PyObject* self, PyObject* args, PyObject* kwds) {
+	static char *kwlist[] = { "key", "iv", "data", "aad", NULL };
+	PyObject *key_obj;
+	Py_buffer iv_buf, in_buf;
+	Py_buffer aad_buf = { 0 };
+	PyObject *result = NULL;
 
-	int current_column = 0;
-	while (current_column < 4) { // 4 columns in the state
-		a[0] = state[current_column +  0];
-		a[1] = state[current_column +  4];
-		a[2] = state[current_column +  8];
-		a[3] = state[current_column + 12];
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*y*|y*", kwlist, &key_obj, &iv_buf, &in_buf, &aad_buf)) {
+		return NULL;
+	}
 
-		state[current_column +  0] = galois_2[a[0]] ^ galois_3[a[1]] ^          a[2]  ^          a[3] ;
-		state[current_column +  4] =          a[0]  ^ galois_2[a[1]] ^ galois_3[a[2]] ^          a[3] ;
-		state[current_column +  8] =          a[0]  ^          a[1]  ^ galois_2[a[2]] ^ galois_3[a[3]];
-		state[current_column + 12] = galois_3[a[0]] ^          a[1]  ^          a[2]  ^ galois_2[a[3]];
+	module_state *st = get_state(self);
+	const cipher_backend *be = load_backend(st);
+	key_schedule scratch;
+	key_schedule *ks = gcm_args(st, be, key_obj, &scratch, &iv_buf, &in_buf);
+	if (ks != NULL) {
+		PyObject *data = PyBytes_FromStringAndSize(NULL, in_buf.len);
+		PyObject *tag = PyBytes_FromStringAndSize(NULL, GCM_TAG_SIZE);
+		if (data != NULL && tag != NULL) {
+			Py_BEGIN_ALLOW_THREADS
+			uint64_t start = stats_start();
+			gcm_crypt(be, ks, iv_buf.buf, aad_buf.buf, (size_t)aad_buf.len, in_buf.buf,
+				(unsigned char *)PyBytes_AS_STRING(data), (size_t)in_buf.len,
+				(unsigned char *)PyBytes_AS_STRING(tag), ENCRYPT);
+			stats_record(be, STAT_GCM, ENCRYPT, (size_t)in_buf.len, start);
+			Py_END_ALLOW_THREADS
+			result = PyTuple_Pack(2, data, tag);
+		}
+		Py_XDECREF(data);
+		Py_XDECREF(tag);
+	}
 
-		current_column += 1;
+	PyBuffer_Release(&iv_buf);
+	PyBuffer_Release(&in_buf);
+	if (aad_buf.obj != NULL) {
+		PyBuffer_Release(&aad_buf);
 	}
+	return result;
 }
 
-// inv_mix_columns algorithm from https://cryptography.fandom.com/wiki/Rijndael_mix_columns
-static void inv_mix_columns(unsigned char *state) {
-	unsigned char a[4];
+static PyObject* gcm_decrypt(PyObject* self, PyObject* args, PyObject* kwds) {
+	static char *kwlist[] = { "key", "iv", "data", "tag", "aad", NULL };
+	PyObject *key_obj;
+	Py_buffer iv_buf, in_buf, tag_buf;
+	Py_buffer aad_buf = { 0 };
+	PyObject *result = NULL;
 
-	int current_column = 0;
-	while (current_column < 4) { // 4 columns in the state
-		a[0] = state[current_column +  0];
-		a[1] = state[current_column +  4];
-		a[2] = state[current_column +  8];
-		a[3] = state[current_column + 12];
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*y*y*|y*", kwlist, &key_obj, &iv_buf, &in_buf, &tag_buf, &aad_buf)) {
+		return NULL;
+	}
 
-		state[current_column +  0] = galois_e[a[0]] ^ galois_b[a[1]] ^ galois_d[a[2]] ^ galois_9[a[3]];
-		state[current_column +  4] = galois_9[a[0]] ^ galois_e[a[1]] ^ galois_b[a[2]] ^ galois_d[a[3]];
-		state[current_column +  8] = galois_d[a[0]] ^ galois_9[a[1]] ^ galois_e[a[2]] ^ galois_b[a[3]];
-		state[current_column + 12] = galois_b[a[0]] ^ galois_d[a[1]] ^ galois_9[a[2]] ^ galois_e[a[3]];
+	module_state *st = get_state(self);
+	const cipher_backend *be = load_backend(st);
+	key_schedule scratch;
+	key_schedule *ks = gcm_args(st, be, key_obj, &scratch, &iv_buf, &in_buf);
+	if (ks != NULL && tag_buf.len != GCM_TAG_SIZE) {
+		PyErr_Format(PyExc_ValueError, "tag must be %d bytes", GCM_TAG_SIZE);
+		ks = NULL;
+	}
+	if (ks != NULL) {
+		result = PyBytes_FromStringAndSize(NULL, in_buf.len);
+		if (result != NULL) {
+			unsigned char tag[GCM_TAG_SIZE];
+			unsigned char diff = 0;
+			Py_BEGIN_ALLOW_THREADS
+			uint64_t start = stats_start();
+			gcm_crypt(be, ks, iv_buf.buf, aad_buf.buf, (size_t)aad_buf.len, in_buf.buf,
+				(unsigned char *)PyBytes_AS_STRING(result), (size_t)in_buf.len, tag, DECRYPT);
+			stats_record(be, STAT_GCM, DECRYPT, (size_t)in_buf.len, start);
+			Py_END_ALLOW_THREADS
+			// compared in constant time, and nothing is returned unless it matches
+			for (int i = 0; i < GCM_TAG_SIZE; i++) {
+				diff |= tag[i] ^ ((unsigned char *)tag_buf.buf)[i];
+			}
+			if (diff != 0) {
+				Py_CLEAR(result);
+				PyErr_SetString(PyExc_ValueError, "GCM authentication failed");
+			}
+		}
+	}
 
-		current_column += 1;
+	PyBuffer_Release(&iv_buf);
+	PyBuffer_Release(&in_buf);
+	PyBuffer_Release(&tag_buf);
+	if (aad_buf.obj != NULL) {
+		PyBuffer_Release(&aad_buf);
 	}
+	return result;
 }
 
-static void encrypt_block_cipher(unsigned char *key, unsigned char *input, unsigned char *state) {
-	unsigned char round_keys[ROUNDS * KEY_SIZE];
-	generate_round_keys(key, round_keys);
+/**
+ * xts_encrypt/xts_decrypt: XTS-AES as in IEEE 1619. data is whole sectors
+ * of sector_size bytes, numbered from first_sector, in the standard byte
+ * order; key1 encrypts the data and key2 the tweaks, both in the module's
+ * byte order like every other key
+**/
+static PyObject* xts_run(module_state *st, PyObject *args, PyObject *kwds, int mode) {
+	static char *kwlist[] = { "key1", "key2", "data", "sector_size", "first_sector", "out", NULL };
+	PyObject *key1_obj, *key2_obj;
+	Py_buffer in_buf;
+	Py_ssize_t sector_size;
+	PyObject *first_obj = NULL;
+	unsigned long long first_sector = 0;
+	PyObject *out_obj = NULL;
+	Py_buffer out_buf = { 0 };
+	PyObject *result = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOy*n|OO", kwlist,
+			&key1_obj, &key2_obj, &in_buf, &sector_size, &first_obj, &out_obj)) {
+		return NULL;
+	}
+
+	// K would wrap negative and oversized numbers silently
+	if (first_obj != NULL) {
+		first_sector = PyLong_AsUnsignedLongLong(first_obj);
+		if (first_sector == (unsigned long long)-1 && PyErr_Occurred()) {
+			goto done;
+		}
+	}
+
+	if (sector_size < STATE_SIZE) {
+		PyErr_Format(PyExc_ValueError, "sector_size must be at least %d bytes", STATE_SIZE);
+		goto done;
+	}
+	if (in_buf.len % sector_size != 0) {
+		PyErr_SetString(PyExc_ValueError, "data is not a whole number of sectors");
+		goto done;
+	}
+	// the last sector's number, first_sector + sectors - 1, must still fit
+	if (in_buf.len > 0 && (uint64_t)(in_buf.len / sector_size) - 1 > UINT64_MAX - first_sector) {
+		PyErr_SetString(PyExc_OverflowError, "sector numbers run past 2**64 - 1");
+		goto done;
+	}
+
+	const cipher_backend *be = load_backend(st);
+	key_schedule scratch1, scratch2;
+	key_schedule *ks1 = get_key_schedule(st, be, key1_obj, &scratch1);
+	if (ks1 == NULL) {
+		goto done;
+	}
+	key_schedule *ks2 = get_key_schedule(st, be, key2_obj, &scratch2);
+	if (ks2 == NULL) {
+		goto done;
+	}
+	if (mode == DECRYPT) {
+		prepare_decrypt(be, ks1);
+	}
+
+	unsigned char *out;
+	if (out_obj == NULL || out_obj == Py_None) {
+		result = PyBytes_FromStringAndSize(NULL, in_buf.len);
+		if (result == NULL) {
+			goto done;
+		}
+		out = (unsigned char *)PyBytes_AS_STRING(result);
+	} else {
+		if (PyObject_GetBuffer(out_obj, &out_buf, PyBUF_WRITABLE) < 0) {
+			goto done;
+		}
+		if (out_buf.len < in_buf.len) {
+			PyErr_SetString(PyExc_ValueError, "out is smaller than the data to process");
+			goto done;
+		}
+		out = out_buf.buf;
+	}
+
+	xts_call call = { be, ks1, ks2, first_sector, in_buf.buf, out,
+		(size_t)sector_size, (size_t)(in_buf.len / sector_size), 0, mode };
 
-	// first state is input
-	for (int i = 0; i < KEY_SIZE; i++) {
-		state[i] = input[i];
+	Py_BEGIN_ALLOW_THREADS
+	uint64_t start = stats_start();
+	xts_crypt(&call);
+	stats_record(be, STAT_XTS, mode, (size_t)in_buf.len, start);
+	Py_END_ALLOW_THREADS
+
+	if (out_buf.obj != NULL) {
+		result = PyLong_FromSsize_t(in_buf.len);
 	}
 
-	int current_round = 0;
+done:
+	PyBuffer_Release(&in_buf);
+	if (out_buf.obj != NULL) {
+		PyBuffer_Release(&out_buf);
+	}
+	return result;
+}
 
-	// round 0, just add_round_key
-	add_round_key(state, round_keys, current_round);
-	current_round += 1;
+static PyObject* xts_encrypt(PyObject* self, PyObject* args, PyObject* kwds) {
+	return xts_run(get_state(self), args, kwds, ENCRYPT);
+}
 
-	// last round is different
-	while (current_round < ROUNDS - 1) {
-			sub_bytes(state);
-			shift_rows(state);
-			mix_columns(state);
-			add_round_key(state, round_keys, current_round);
+static PyObject* xts_decrypt(PyObject* self, PyObject* args, PyObject* kwds) {
+	return xts_run(get_state(self), args, kwds, DECRYPT);
+}
 
-			current_round += 1;
+/**
+ * Incremental cipher objects from the Encryptor/Decryptor factories. The
+ * chaining value and any partial block carried between update() calls live
+ * in the object, so input of any size streams through in fixed memory
+**/
+typedef struct {
+	PyObject_HEAD
+	const cipher_backend *be; // the backend the schedule was made for
+	key_schedule ks;
+	int mode_id;
+	int mode;
+	unsigned char chain[STATE_SIZE];
+	unsigned char carry[STATE_SIZE];
+	size_t carry_len;
+	int finalized;
+	long busy; // claimed for the length of each update()/finalize()
+} StreamObject;
+
+// runs whole blocks through the stream and moves its chaining value on
+static void stream_blocks(StreamObject *st, const unsigned char *in, unsigned char *out, size_t blocks) {
+	unsigned char last_in[STATE_SIZE];
+
+	if (blocks == 0) {
+		return;
 	}
+	memcpy(last_in, in + (blocks - 1) * STATE_SIZE, STATE_SIZE);
+	crypt_mode(st->be, &st->ks, st->mode_id, st->chain, in, out, blocks, st->mode);
+	advance_chain(st->mode_id, st->mode, st->chain, last_in, out + (blocks - 1) * STATE_SIZE, blocks);
+}
 
-	//final round
-	sub_bytes(state);
-	shift_rows(state);
-	add_round_key(state, round_keys, current_round);
+// claims the stream for one call; release with unclaim(&st->busy)
+static int stream_ready(StreamObject *st) {
+	if (!claim(&st->busy)) {
+		PyErr_SetString(PyExc_RuntimeError, "stream used from two threads at once");
+		return 0;
+	}
+	if (st->finalized) {
+		unclaim(&st->busy);
+		PyErr_SetString(PyExc_ValueError, "stream already finalized");
+		return 0;
+	}
+	return 1;
 }
 
-static void decrypt_block_cipher(unsigned char *key, unsigned char *input, unsigned char *state) {
-	unsigned char round_keys[ROUNDS * KEY_SIZE];
-	generate_round_keys(key, round_keys);
+static PyObject* Stream_update(StreamObject *self, PyObject *args) {
+	Py_buffer in_buf;
+
+	if (!PyArg_ParseTuple(args, "y*", &in_buf)) {
+		return NULL;
+	}
+	if (!stream_ready(self)) {
+		PyBuffer_Release(&in_buf);
+		return NULL;
+	}
+
+	const unsigned char *in = in_buf.buf;
+	size_t len = (size_t)in_buf.len;
+	size_t blocks = (self->carry_len + len) / STATE_SIZE;
 
-	// first state is input
-	for (int i = 0; i < KEY_SIZE; i++) {
-		state[i] = input[i];
+	PyObject *result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)(blocks * STATE_SIZE));
+	if (result == NULL) {
+		unclaim(&self->busy);
+		PyBuffer_Release(&in_buf);
+		return NULL;
+	}
+	unsigned char *out = (unsigned char *)PyBytes_AS_STRING(result);
+	uint64_t start = stats_start();
+
+	if (blocks > 0 && self->carry_len > 0) {
+		// complete the carried block first
+		size_t fill = STATE_SIZE - self->carry_len;
+		memcpy(self->carry + self->carry_len, in, fill);
+		stream_blocks(self, self->carry, out, 1);
+		in += fill;
+		len -= fill;
+		out += STATE_SIZE;
+		blocks -= 1;
+		self->carry_len = 0;
 	}
 
-	int current_round = ROUNDS-1;
+	Py_BEGIN_ALLOW_THREADS
+	stream_blocks(self, in, out, blocks);
+	Py_END_ALLOW_THREADS
+	stats_record(self->be, self->mode_id, self->mode, (size_t)PyBytes_GET_SIZE(result), start);
+
+	in += blocks * STATE_SIZE;
+	len -= blocks * STATE_SIZE;
+	memcpy(self->carry + self->carry_len, in, len);
+	self->carry_len += len;
+	unclaim(&self->busy);
+
+	PyBuffer_Release(&in_buf);
+	return result;
+}
+
+static PyObject* Stream_finalize(StreamObject *self, PyObject *unused) {
+	if (!stream_ready(self)) {
+		return NULL;
+	}
 
-	// round 0 == add_round_key()
-	add_round_key(state, round_keys, current_round);
-	current_round -= 1;
+	PyObject *result = NULL;
 
-	while (current_round > 0) {
-		inv_shift_rows(state);
-		inv_sub_bytes(state);
-		add_round_key(state, round_keys, current_round);
-		inv_mix_columns(state);
+	if (self->carry_len > 0 && !mode_streams(self->mode_id)) {
+		PyErr_Format(PyExc_ValueError, "%s input is not a multiple of %d bytes, %zu left over",
+			modes[self->mode_id].name, STATE_SIZE, self->carry_len);
+		goto done;
+	}
 
-		current_round -= 1;
+	result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)self->carry_len);
+	if (result == NULL) {
+		goto done;
 	}
+	uint64_t start = stats_start();
+	crypt_tail(self->be, &self->ks, self->chain, self->carry,
+		(unsigned char *)PyBytes_AS_STRING(result), self->carry_len);
+	stats_record(self->be, self->mode_id, self->mode, self->carry_len, start);
+
+	self->finalized = 1;
+	self->carry_len = 0;
 
-	inv_shift_rows(state);
-	inv_sub_bytes(state);
-	add_round_key(state, round_keys, current_round);
+done:
+	unclaim(&self->busy);
+	return result;
 }
 
-static PyObject* blockcipher(PyObject* self, PyObject* args) {
-	PyObject* key_list;
-	PyObject* in_list;
-	int mode_in;
+static PyMethodDef Stream_methods[] = {
+	{ "update", (PyCFunction)Stream_update, METH_VARARGS,
+		"update(data) -> bytes for every whole block available so far" },
+	{ "finalize", (PyCFunction)Stream_finalize, METH_NOARGS,
+		"finalize() -> the short last block for cfb/ofb/ctr; raises for other modes if bytes are left over" },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyType_Slot Stream_slots[] = {
+	{ Py_tp_doc, "Incremental cipher, created by the *Encryptor/*Decryptor factories" },
+	{ Py_tp_methods, Stream_methods },
+	{ Py_tp_dealloc, heap_dealloc },
+	{ 0, NULL }
+};
+
+static PyType_Spec Stream_spec = {
+	"blockcipher.StreamCipher", sizeof(StreamObject), 0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION, Stream_slots
+};
 
-	if (!PyArg_ParseTuple(args, "OOi", &key_list, &in_list, &mode_in)) {
-		printf("fail\n");
+static PyObject* new_stream(module_state *ms, PyObject *args, PyObject *kwds, int mode_id, int mode) {
+	static char *kwlist[] = { "key", "iv", NULL };
+	static char *ecb_kwlist[] = { "key", NULL };
+	static char *ctr_kwlist[] = { "key", "nonce", NULL };
+	PyObject *key_obj;
+	Py_buffer iv_buf = { 0 };
+	unsigned long long nonce = 0;
+	int ok;
+
+	if (mode_id == MODE_ECB) {
+		ok = PyArg_ParseTupleAndKeywords(args, kwds, "O", ecb_kwlist, &key_obj);
+	} else if (mode_id == MODE_CTR) {
+		ok = PyArg_ParseTupleAndKeywords(args, kwds, "OK", ctr_kwlist, &key_obj, &nonce);
+	} else {
+		ok = PyArg_ParseTupleAndKeywords(args, kwds, "Oy*", kwlist, &key_obj, &iv_buf);
+	}
+	if (!ok) {
 		return NULL;
 	}
 
-	if (!PyList_CheckExact(key_list) || !PyList_CheckExact(in_list)) {
-		printf("blockcipher handed something not a list\n");
+	StreamObject *st = NULL;
+	key_schedule *ks;
+
+	if (iv_buf.obj != NULL && iv_buf.len != STATE_SIZE) {
+		PyErr_Format(PyExc_ValueError, "iv must be %d bytes", STATE_SIZE);
+		goto done;
+	}
+
+	st = PyObject_New(StreamObject, ms->stream_type);
+	if (st == NULL) {
+		goto done;
+	}
+	st->be = load_backend(ms);
+	st->mode_id = mode_id;
+	st->mode = mode;
+	st->carry_len = 0;
+	st->finalized = 0;
+	st->busy = 0;
+
+	ks = get_key_schedule(ms, st->be, key_obj, &st->ks);
+	if (ks == NULL) {
+		Py_CLEAR(st);
+		goto done;
+	}
+	if (ks != &st->ks) {
+		st->ks = *ks;
+	}
+	if (mode == DECRYPT && modes[mode_id].uses_inverse) {
+		prepare_decrypt(st->be, &st->ks);
+	}
+
+	if (mode_id == MODE_CTR) {
+		nonce_counter_block(nonce, st->chain);
+	} else if (iv_buf.obj != NULL) {
+		memcpy(st->chain, iv_buf.buf, STATE_SIZE);
+	}
+
+done:
+	if (iv_buf.obj != NULL) {
+		PyBuffer_Release(&iv_buf);
+	}
+	return (PyObject *)st;
+}
+
+#define STREAM_FACTORY(func, mode_id, mode) \
+	static PyObject* func(PyObject* self, PyObject* args, PyObject* kwds) { \
+		return new_stream(get_state(self), args, kwds, mode_id, mode); \
+	}
+
+STREAM_FACTORY(ecb_encryptor, MODE_ECB, ENCRYPT)
+STREAM_FACTORY(ecb_decryptor, MODE_ECB, DECRYPT)
+STREAM_FACTORY(cbc_encryptor, MODE_CBC, ENCRYPT)
+STREAM_FACTORY(cbc_decryptor, MODE_CBC, DECRYPT)
+STREAM_FACTORY(pcbc_encryptor, MODE_PCBC, ENCRYPT)
+STREAM_FACTORY(pcbc_decryptor, MODE_PCBC, DECRYPT)
+STREAM_FACTORY(cfb_encryptor, MODE_CFB, ENCRYPT)
+STREAM_FACTORY(cfb_decryptor, MODE_CFB, DECRYPT)
+STREAM_FACTORY(ofb_encryptor, MODE_OFB, ENCRYPT)
+STREAM_FACTORY(ofb_decryptor, MODE_OFB, DECRYPT)
+STREAM_FACTORY(ctr_encryptor, MODE_CTR, ENCRYPT)
+STREAM_FACTORY(ctr_decryptor, MODE_CTR, DECRYPT)
+
+/**
+ * Keystream objects from OFBKeystream/CTRKeystream: keystream made ahead on
+ * a thread of their own, or by fill() when the caller has time, so crypt()
+ * is a XOR against bytes already waiting. The backend is fixed when the
+ * object is made
+**/
+typedef struct {
+	PyObject_HEAD
+	keystream kst;
+	int open;
+	long busy; // claimed for the length of each crypt()/fill()/close()
+} KeystreamObject;
+
+// claims the keystream for one call; release with unclaim(&self->busy)
+static int keystream_ready(KeystreamObject *self) {
+	if (!claim(&self->busy)) {
+		PyErr_SetString(PyExc_RuntimeError, "keystream used from two threads at once");
+		return 0;
+	}
+	if (!self->open) {
+		unclaim(&self->busy);
+		PyErr_SetString(PyExc_ValueError, "keystream is closed");
+		return 0;
+	}
+	return 1;
+}
+
+static PyObject* Keystream_crypt(KeystreamObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = { "data", "out", NULL };
+	Py_buffer in_buf;
+	PyObject *out_obj = NULL;
+	Py_buffer out_buf = { 0 };
+	PyObject *result = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|O", kwlist, &in_buf, &out_obj)) {
+		return NULL;
+	}
+	if (!keystream_ready(self)) {
+		PyBuffer_Release(&in_buf);
 		return NULL;
 	}
 
-	int in_size = (int)PyList_Size(in_list);
+	unsigned char *out;
+	if (out_obj == NULL || out_obj == Py_None) {
+		result = PyBytes_FromStringAndSize(NULL, in_buf.len);
+		if (result == NULL) {
+			goto done;
+		}
+		out = (unsigned char *)PyBytes_AS_STRING(result);
+	} else {
+		if (PyObject_GetBuffer(out_obj, &out_buf, PyBUF_WRITABLE) < 0) {
+			goto done;
+		}
+		if (out_buf.len < in_buf.len) {
+			PyErr_SetString(PyExc_ValueError, "out is smaller than the data to process");
+			goto done;
+		}
+		out = out_buf.buf;
+	}
 
-	if (in_size != STATE_SIZE) {
-		printf("blockcipher handed list with invalid size\n");
+	Py_BEGIN_ALLOW_THREADS
+	uint64_t start = stats_start();
+	keystream_xor(&self->kst, in_buf.buf, out, (size_t)in_buf.len);
+	stats_record(self->kst.be, self->kst.mode_id, ENCRYPT, (size_t)in_buf.len, start);
+	Py_END_ALLOW_THREADS
+
+	if (out_buf.obj != NULL) {
+		result = PyLong_FromSsize_t(in_buf.len);
+	}
+
+done:
+	unclaim(&self->busy);
+	PyBuffer_Release(&in_buf);
+	if (out_buf.obj != NULL) {
+		PyBuffer_Release(&out_buf);
+	}
+	return result;
+}
+
+static PyObject* Keystream_fill(KeystreamObject *self, PyObject *unused) {
+	if (!keystream_ready(self)) {
 		return NULL;
 	}
 
-	unsigned char key[KEY_SIZE];
-	unsigned char input[STATE_SIZE];
-	unsigned char output[STATE_SIZE];
+	Py_BEGIN_ALLOW_THREADS
+	keystream_fill(&self->kst);
+	Py_END_ALLOW_THREADS
+	unclaim(&self->busy);
+	Py_RETURN_NONE;
+}
 
-	for (int i = 0; i < KEY_SIZE; i++) {
-		key[i] = (unsigned char)PyLong_AsLong(PyList_GetItem(key_list, i));
+static PyObject* Keystream_close(KeystreamObject *self, PyObject *unused) {
+	if (!claim(&self->busy)) {
+		PyErr_SetString(PyExc_RuntimeError, "keystream used from two threads at once");
+		return NULL;
 	}
 
-	for (int i = 0; i < STATE_SIZE; i++) {
-		input[i] = (unsigned char)PyLong_AsLong(PyList_GetItem(in_list, i));
+	if (self->open) {
+		self->open = 0;
+		Py_BEGIN_ALLOW_THREADS
+		keystream_free(&self->kst);
+		Py_END_ALLOW_THREADS
 	}
+	unclaim(&self->busy);
+	Py_RETURN_NONE;
+}
 
-	if (mode_in == ENCRYPT) {
-		encrypt_block_cipher(key, input, output);
-	} else if (mode_in == DECRYPT) {
-		decrypt_block_cipher(key, input, output);
+static PyObject* Keystream_get_buffered(KeystreamObject *self, void *closure) {
+	return PyLong_FromSize_t(self->open ? keystream_buffered(&self->kst) : 0);
+}
+
+static PyObject* Keystream_get_lookahead(KeystreamObject *self, void *closure) {
+	return PyLong_FromSize_t(self->kst.capacity);
+}
+
+static void Keystream_dealloc(KeystreamObject *self) {
+	if (self->open) {
+		keystream_free(&self->kst);
+	}
+	heap_dealloc((PyObject *)self);
+}
+
+static PyMethodDef Keystream_methods[] = {
+	{ "crypt", (PyCFunction)Keystream_crypt, METH_VARARGS | METH_KEYWORDS,
+		"crypt(data, out=None) -> data XORed with the next len(data) bytes of keystream, or bytes written into out; "
+		"encrypts and decrypts alike" },
+	{ "fill", (PyCFunction)Keystream_fill, METH_NOARGS, "fill() -> makes keystream on this thread until lookahead bytes are ready" },
+	{ "close", (PyCFunction)Keystream_close, METH_NOARGS, "close() -> stops the background thread and frees the buffer" },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef Keystream_getset[] = {
+	{ "buffered", (getter)Keystream_get_buffered, NULL, "bytes of keystream made and not yet used", NULL },
+	{ "lookahead", (getter)Keystream_get_lookahead, NULL, "bytes of keystream kept ready at most", NULL },
+	{ NULL }
+};
+
+static PyType_Slot Keystream_slots[] = {
+	{ Py_tp_doc, "Keystream made ahead of use, created by OFBKeystream/CTRKeystream" },
+	{ Py_tp_methods, Keystream_methods },
+	{ Py_tp_getset, Keystream_getset },
+	{ Py_tp_dealloc, Keystream_dealloc },
+	{ 0, NULL }
+};
+
+static PyType_Spec Keystream_spec = {
+	"blockcipher.Keystream", sizeof(KeystreamObject), 0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION, Keystream_slots
+};
+
+static PyObject* new_keystream(module_state *st, PyObject *args, PyObject *kwds, int mode_id) {
+	static char *kwlist[] = { "key", "iv", "lookahead", "background", NULL };
+	static char *ctr_kwlist[] = { "key", "nonce", "lookahead", "background", NULL };
+	PyObject *key_obj;
+	Py_buffer iv_buf = { 0 };
+	unsigned long long nonce = 0;
+	Py_ssize_t lookahead = 65536;
+	int background = 1;
+	unsigned char iv[STATE_SIZE];
+	int ok;
+
+	if (mode_id == MODE_CTR) {
+		ok = PyArg_ParseTupleAndKeywords(args, kwds, "OK|np", ctr_kwlist, &key_obj, &nonce, &lookahead, &background);
 	} else {
-		printf("INVALID ENCRYPT/DECRYPT MODE\n");
+		ok = PyArg_ParseTupleAndKeywords(args, kwds, "Oy*|np", kwlist, &key_obj, &iv_buf, &lookahead, &background);
+	}
+	if (!ok) {
 		return NULL;
 	}
 
-	PyObject* out_list = PyList_New(STATE_SIZE);
-	for (int i = 0; i < STATE_SIZE; i++) {
-		PyList_SetItem(out_list, i, PyLong_FromLong((long)output[i]));
+	KeystreamObject *ko = NULL;
+	const cipher_backend *be;
+	key_schedule scratch;
+	key_schedule *ks;
+
+	if (iv_buf.obj != NULL && iv_buf.len != STATE_SIZE) {
+		PyErr_Format(PyExc_ValueError, "iv must be %d bytes", STATE_SIZE);
+		goto done;
+	}
+	if (lookahead <= 0) {
+		PyErr_SetString(PyExc_ValueError, "lookahead must be positive");
+		goto done;
+	}
+	be = load_backend(st);
+	ks = get_key_schedule(st, be, key_obj, &scratch);
+	if (ks == NULL) {
+		goto done;
 	}
 
-	return out_list;
+	if (mode_id == MODE_CTR) {
+		nonce_counter_block(nonce, iv);
+	} else {
+		memcpy(iv, iv_buf.buf, STATE_SIZE);
+	}
+
+	ko = PyObject_New(KeystreamObject, st->keystream_type);
+	if (ko == NULL) {
+		goto done;
+	}
+	ko->open = 0;
+	ko->busy = 0;
+	if (keystream_init(&ko->kst, be, ks, mode_id, iv, (size_t)lookahead, background) < 0) {
+		Py_CLEAR(ko);
+		PyErr_SetString(PyExc_MemoryError, "cannot allocate the keystream buffer or start its thread");
+		goto done;
+	}
+	ko->open = 1;
+
+done:
+	if (iv_buf.obj != NULL) {
+		PyBuffer_Release(&iv_buf);
+	}
+	return (PyObject *)ko;
+}
+
+static PyObject* ofb_keystream(PyObject* self, PyObject* args, PyObject* kwds) {
+	return new_keystream(get_state(self), args, kwds, MODE_OFB);
+}
+
+static PyObject* ctr_keystream(PyObject* self, PyObject* args, PyObject* kwds) {
+	return new_keystream(get_state(self), args, kwds, MODE_CTR);
+}
+
+static void set_file_error(PyObject *path) {
+#ifdef _WIN32
+	PyErr_SetExcFromWindowsErrWithFilenameObject(PyExc_OSError, 0, path);
+#else
+	PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+#endif
+}
+
+/**
+ * Reads the iv argument of the calls that take a mode by name: the nonce
+ * for ctr, as for ctr(), 16 bytes for the rest, nothing for ecb
+**/
+static int parse_iv(int mode_id, PyObject *iv_obj, unsigned char *iv) {
+	if (mode_id == MODE_CTR) {
+		unsigned long long nonce = PyLong_AsUnsignedLongLongMask(iv_obj);
+		if (nonce == (unsigned long long)-1 && PyErr_Occurred()) {
+			return -1;
+		}
+		nonce_counter_block(nonce, iv);
+	} else if (mode_id != MODE_ECB) {
+		Py_buffer iv_buf;
+		if (PyObject_GetBuffer(iv_obj, &iv_buf, PyBUF_SIMPLE) < 0) {
+			return -1;
+		}
+		if (iv_buf.len != STATE_SIZE) {
+			PyBuffer_Release(&iv_buf);
+			PyErr_Format(PyExc_ValueError, "iv must be %d bytes", STATE_SIZE);
+			return -1;
+		}
+		memcpy(iv, iv_buf.buf, STATE_SIZE);
+		PyBuffer_Release(&iv_buf);
+	}
+	return 0;
+}
+
+/**
+ * encrypt_file/decrypt_file: maps src and a dst of the same size and runs
+ * the mode over the mappings with the GIL released, split across the pool
+ * like any other large call. src and dst may name the same file
+**/
+static PyObject* file_crypt(module_state *st, PyObject *args, PyObject *kwds, int mode) {
+	static char *kwlist[] = { "src", "dst", "mode", "key", "iv", NULL };
+	PyObject *src_obj, *dst_obj;
+	PyObject *src_path = NULL, *dst_path = NULL;
+	const char *mode_name;
+	PyObject *key_obj;
+	PyObject *iv_obj = Py_None;
+	unsigned char iv[STATE_SIZE] = { 0 };
+	PyObject *result = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOsO|O", kwlist, &src_obj, &dst_obj, &mode_name, &key_obj, &iv_obj)) {
+		return NULL;
+	}
+	if (!PyUnicode_FSConverter(src_obj, &src_path) || !PyUnicode_FSConverter(dst_obj, &dst_path)) {
+		goto done;
+	}
+
+	int mode_id = find_mode(mode_name);
+	if (mode_id < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown mode '%s'", mode_name);
+		goto done;
+	}
+
+	if (parse_iv(mode_id, iv_obj, iv) < 0) {
+		goto done;
+	}
+
+	const cipher_backend *be = load_backend(st);
+	key_schedule scratch;
+	key_schedule *ks = get_key_schedule(st, be, key_obj, &scratch);
+	if (ks == NULL) {
+		goto done;
+	}
+	if (mode == DECRYPT && modes[mode_id].uses_inverse) {
+		prepare_decrypt(be, ks);
+	}
+
+	mapped_file in, out;
+	if (map_file(PyBytes_AS_STRING(src_path), 0, 0, &in) < 0) {
+		set_file_error(src_obj);
+		goto done;
+	}
+	// checked before dst is opened so a bad call leaves dst alone
+	if (in.size % STATE_SIZE != 0 && !mode_streams(mode_id)) {
+		PyErr_Format(PyExc_ValueError, "%s input is not a multiple of %d bytes", mode_name, STATE_SIZE);
+		unmap_file(&in);
+		goto done;
+	}
+	if (map_file(PyBytes_AS_STRING(dst_path), 1, in.size, &out) < 0) {
+		set_file_error(dst_obj);
+		unmap_file(&in);
+		goto done;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	uint64_t start = stats_start();
+	crypt_whole(be, ks, mode_id, iv, in.data, out.data, in.size, mode);
+	stats_record(be, mode_id, mode, in.size, start);
+	Py_END_ALLOW_THREADS
+
+	result = PyLong_FromSize_t(in.size);
+	unmap_file(&out);
+	unmap_file(&in);
+
+done:
+	Py_XDECREF(src_path);
+	Py_XDECREF(dst_path);
+	return result;
+}
+
+static PyObject* encrypt_file(PyObject* self, PyObject* args, PyObject* kwds) {
+	return file_crypt(get_state(self), args, kwds, ENCRYPT);
+}
+
+static PyObject* decrypt_file(PyObject* self, PyObject* args, PyObject* kwds) {
+	return file_crypt(get_state(self), args, kwds, DECRYPT);
+}
+
+/**
+ * decrypt_range(): decrypts data[offset:offset + length] of a longer
+ * ciphertext without the blocks before it. The chaining value of the
+ * first covering block comes straight from the iv: the counter plus the
+ * block index for ctr, the previous ciphertext block for cbc and cfb
+**/
+static PyObject* decrypt_range(PyObject* self, PyObject* args, PyObject* kwds) {
+	static char *kwlist[] = { "mode_name", "key", "iv", "data", "offset", "length", "out", NULL };
+	const char *mode_name;
+	PyObject *key_obj;
+	PyObject *iv_obj;
+	Py_buffer in_buf;
+	Py_ssize_t offset, length;
+	PyObject *out_obj = NULL;
+	unsigned char iv[STATE_SIZE] = { 0 };
+	Py_buffer out_buf = { 0 };
+	PyObject *result = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sOOy*nn|O", kwlist,
+			&mode_name, &key_obj, &iv_obj, &in_buf, &offset, &length, &out_obj)) {
+		return NULL;
+	}
+
+	int mode_id = find_mode(mode_name);
+	if (mode_id < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown mode '%s'", mode_name);
+		goto done;
+	}
+	if (!mode_splits(mode_id, DECRYPT)) {
+		PyErr_Format(PyExc_ValueError, "%s decryption cannot start mid-stream", mode_name);
+		goto done;
+	}
+	if (offset < 0 || length < 0 || offset > in_buf.len || length > in_buf.len - offset) {
+		PyErr_SetString(PyExc_ValueError, "range is outside data");
+		goto done;
+	}
+	if (parse_iv(mode_id, iv_obj, iv) < 0) {
+		goto done;
+	}
+
+	// the blocks covering the range; only the stream modes may end on a short one
+	size_t first = (size_t)offset / STATE_SIZE;
+	size_t start = first * STATE_SIZE;
+	size_t end = ((size_t)(offset + length) + STATE_SIZE - 1) / STATE_SIZE * STATE_SIZE;
+	if (end > (size_t)in_buf.len) {
+		if (!mode_streams(mode_id)) {
+			PyErr_Format(PyExc_ValueError, "%s input is not a multiple of %d bytes", mode_name, STATE_SIZE);
+			goto done;
+		}
+		end = (size_t)in_buf.len;
+	}
+	if (length == 0) {
+		end = start;
+	}
+
+	key_schedule scratch;
+	module_state *st = get_state(self);
+	const cipher_backend *be = load_backend(st);
+	key_schedule *ks = get_key_schedule(st, be, key_obj, &scratch);
+	if (ks == NULL) {
+		goto done;
+	}
+	if (modes[mode_id].uses_inverse) {
+		prepare_decrypt(be, ks);
+	}
+
+	unsigned char *out;
+	if (out_obj == NULL || out_obj == Py_None) {
+		result = PyBytes_FromStringAndSize(NULL, length);
+		if (result == NULL) {
+			goto done;
+		}
+		out = (unsigned char *)PyBytes_AS_STRING(result);
+	} else {
+		if (PyObject_GetBuffer(out_obj, &out_buf, PyBUF_WRITABLE) < 0) {
+			goto done;
+		}
+		if (out_buf.len < length) {
+			PyErr_SetString(PyExc_ValueError, "out is smaller than the data to process");
+			goto done;
+		}
+		out = out_buf.buf;
+	}
+
+	unsigned char *span = PyMem_Malloc(end - start + 1);
+	if (span == NULL) {
+		Py_CLEAR(result);
+		PyErr_NoMemory();
+		goto done;
+	}
+
+	const unsigned char *in = in_buf.buf;
+	if (mode_id == MODE_CTR) {
+		add_counter(iv, first);
+	} else if (first > 0 && mode_id != MODE_ECB) {
+		memcpy(iv, in + start - STATE_SIZE, STATE_SIZE);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	uint64_t began = stats_start();
+	crypt_whole(be, ks, mode_id, iv, in + start, span, end - start, DECRYPT);
+	memcpy(out, span + (offset - start), length);
+	stats_record(be, mode_id, DECRYPT, end - start, began);
+	Py_END_ALLOW_THREADS
+	PyMem_Free(span);
+
+	if (out_buf.obj != NULL) {
+		result = PyLong_FromSsize_t(length);
+	}
+
+done:
+	PyBuffer_Release(&in_buf);
+	if (out_buf.obj != NULL) {
+		PyBuffer_Release(&out_buf);
+	}
+	return result;
+}
+
+/**
+ * batch(): the packed-buffer entry point to crypt_batch. offsets holds
+ * count + 1 increasing byte offsets starting at 0, ivs count * 16 bytes
+ * (full counter blocks for 'ctr', ignored for 'ecb')
+**/
+static PyObject* batch(PyObject* self, PyObject* args, PyObject* kwds) {
+	static char *kwlist[] = { "mode_name", "key", "ivs", "data", "offsets", "mode", "out", NULL };
+	const char *mode_name;
+	PyObject *key_obj;
+	PyObject *ivs_obj;
+	Py_buffer in_buf;
+	PyObject *offsets_obj;
+	int mode;
+	PyObject *out_obj = NULL;
+	Py_buffer ivs_buf = { 0 };
+	Py_buffer out_buf = { 0 };
+	PyObject *offsets_seq = NULL;
+	size_t *offsets = NULL;
+	PyObject *result = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sOOy*Oi|O", kwlist,
+			&mode_name, &key_obj, &ivs_obj, &in_buf, &offsets_obj, &mode, &out_obj)) {
+		return NULL;
+	}
+
+	int mode_id = find_mode(mode_name);
+	if (mode_id < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown mode '%s'", mode_name);
+		goto done;
+	}
+	if (mode != ENCRYPT && mode != DECRYPT) {
+		PyErr_SetString(PyExc_ValueError, "mode_in MUST be 0(encrypt) or 1(decrypt)");
+		goto done;
+	}
+
+	offsets_seq = PySequence_Fast(offsets_obj, "offsets must be a sequence of ints");
+	if (offsets_seq == NULL) {
+		goto done;
+	}
+	Py_ssize_t entries = PySequence_Fast_GET_SIZE(offsets_seq);
+	if (entries < 1) {
+		PyErr_SetString(PyExc_ValueError, "offsets needs at least one entry");
+		goto done;
+	}
+	size_t count = (size_t)entries - 1;
+	offsets = PyMem_Malloc((size_t)entries * sizeof(size_t));
+	if (offsets == NULL) {
+		PyErr_NoMemory();
+		goto done;
+	}
+	for (Py_ssize_t i = 0; i < entries; i++) {
+		offsets[i] = PyLong_AsSize_t(PySequence_Fast_GET_ITEM(offsets_seq, i));
+		if (offsets[i] == (size_t)-1 && PyErr_Occurred()) {
+			goto done;
+		}
+		if ((i == 0 && offsets[i] != 0) || (i > 0 && offsets[i] < offsets[i - 1])) {
+			PyErr_SetString(PyExc_ValueError, "offsets must start at 0 and never decrease");
+			goto done;
+		}
+		if (i > 0 && !mode_streams(mode_id) && (offsets[i] - offsets[i - 1]) % STATE_SIZE != 0) {
+			PyErr_Format(PyExc_ValueError, "%s message %zd is not a multiple of %d bytes", mode_name, i - 1, STATE_SIZE);
+			goto done;
+		}
+	}
+	size_t total = offsets[count];
+	if (total > (size_t)in_buf.len) {
+		PyErr_SetString(PyExc_ValueError, "offsets run past the end of data");
+		goto done;
+	}
+
+	if (mode_id != MODE_ECB) {
+		if (PyObject_GetBuffer(ivs_obj, &ivs_buf, PyBUF_SIMPLE) < 0) {
+			goto done;
+		}
+		if ((size_t)ivs_buf.len != count * STATE_SIZE) {
+			PyErr_Format(PyExc_ValueError, "ivs must be %d bytes per message", STATE_SIZE);
+			goto done;
+		}
+	}
+
+	key_schedule scratch;
+	module_state *st = get_state(self);
+	const cipher_backend *be = load_backend(st);
+	key_schedule *ks = get_key_schedule(st, be, key_obj, &scratch);
+	if (ks == NULL) {
+		goto done;
+	}
+
+	unsigned char *out;
+	if (out_obj == NULL || out_obj == Py_None) {
+		result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)total);
+		if (result == NULL) {
+			goto done;
+		}
+		out = (unsigned char *)PyBytes_AS_STRING(result);
+	} else {
+		if (PyObject_GetBuffer(out_obj, &out_buf, PyBUF_WRITABLE) < 0) {
+			goto done;
+		}
+		if ((size_t)out_buf.len < total) {
+			PyErr_SetString(PyExc_ValueError, "out is smaller than the data to process");
+			goto done;
+		}
+		out = out_buf.buf;
+	}
+
+	batch_call call = { be, ks, mode_id, mode, ivs_buf.buf, in_buf.buf, out, offsets, count, 0 };
+	if (mode == DECRYPT && modes[mode_id].uses_inverse) {
+		prepare_decrypt(call.be, ks);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	uint64_t start = stats_start();
+	crypt_batch(&call);
+	stats_record(call.be, mode_id, mode, total, start);
+	Py_END_ALLOW_THREADS
+
+	if (out_buf.obj != NULL) {
+		result = PyLong_FromSize_t(total);
+	}
+
+done:
+	PyBuffer_Release(&in_buf);
+	if (ivs_buf.obj != NULL) {
+		PyBuffer_Release(&ivs_buf);
+	}
+	if (out_buf.obj != NULL) {
+		PyBuffer_Release(&out_buf);
+	}
+	Py_XDECREF(offsets_seq);
+	PyMem_Free(offsets);
+	return result;
+}
+
+/**
+ * blockcipher.JobQueue: whole mode calls run on worker threads of their
+ * own while the submitting thread carries on, for event loops. Each time
+ * finished jobs start piling up a byte is written to the wakeup socket
+ * (or pipe), and completed() then hands back every (tag, result) pair.
+ * Workers never take the GIL; all Python objects are handled by submit()
+ * and completed()
+**/
+typedef struct {
+	PyObject_HEAD
+	job_queue q;
+	long started; // claimed by the one __init__ that starts the workers
+	int open;     // the queue is set up; stays so after close() until dealloc
+	long closed;  // claimed by the one close() that stops the workers
+	long long wakeup;
+} JobQueueObject;
+
+typedef struct {
+	crypt_job job;
+	key_schedule ks;
+	Py_buffer in;
+	PyObject *tag;
+	PyObject *result;
+} py_job;
+
+static void wake_submitter(void *arg) {
+	JobQueueObject *self = arg;
+	// the reader only needs some byte to be pending, so a full buffer is fine
+#ifdef _WIN32
+	send((SOCKET)self->wakeup, "", 1, 0);
+#else
+	ssize_t unused = write((int)self->wakeup, "", 1);
+	(void)unused;
+#endif
+}
+
+static void release_job(py_job *pj) {
+	PyBuffer_Release(&pj->in);
+	Py_DECREF(pj->tag);
+	Py_XDECREF(pj->result);
+	PyMem_Free(pj);
+}
+
+// [(tag, result)] for a list of finished jobs, freeing them
+static PyObject* finished_jobs(crypt_job *job) {
+	PyObject *list = PyList_New(0);
+
+	while (job != NULL) {
+		py_job *pj = job->owner;
+		job = job->next;
+		if (list != NULL) {
+			PyObject *pair = PyTuple_Pack(2, pj->tag, pj->result);
+			if (pair == NULL || PyList_Append(list, pair) < 0) {
+				Py_CLEAR(list);
+			}
+			Py_XDECREF(pair);
+		}
+		release_job(pj);
+	}
+	return list;
+}
+
+static int JobQueue_init(JobQueueObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = { "wakeup", "workers", NULL };
+	long long wakeup;
+	int workers = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "L|i", kwlist, &wakeup, &workers)) {
+		return -1;
+	}
+	if (!claim(&self->started)) {
+		PyErr_SetString(PyExc_RuntimeError, "JobQueue is already running");
+		return -1;
+	}
+
+	self->wakeup = wakeup;
+	if (job_queue_init(&self->q, workers > 0 ? workers : load_pool_threads(), wake_submitter, self) < 0) {
+		unclaim(&self->started);
+		PyErr_SetString(PyExc_RuntimeError, "cannot start JobQueue workers");
+		return -1;
+	}
+	self->open = 1;
+	return 0;
+}
+
+static PyObject* JobQueue_submit(JobQueueObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = { "tag", "mode_name", "key", "iv", "data", "mode", NULL };
+	PyObject *tag;
+	const char *mode_name;
+	PyObject *key_obj;
+	PyObject *iv_obj;
+	int mode;
+
+	py_job *pj = PyMem_Malloc(sizeof(py_job));
+	if (pj == NULL) {
+		return PyErr_NoMemory();
+	}
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OsOOy*i", kwlist, &tag, &mode_name, &key_obj, &iv_obj, &pj->in, &mode)) {
+		PyMem_Free(pj);
+		return NULL;
+	}
+	pj->tag = tag;
+	pj->result = NULL;
+	Py_INCREF(tag);
+
+	crypt_job *job = &pj->job;
+	memset(job->iv, 0, STATE_SIZE);
+	job->mode_id = find_mode(mode_name);
+	job->mode = mode;
+	// trailing bytes short of a block are dropped, as in the bulk functions
+	job->len = (size_t)pj->in.len / STATE_SIZE * STATE_SIZE;
+	job->in = pj->in.buf;
+	job->owner = pj;
+
+	if (!self->open) {
+		PyErr_SetString(PyExc_ValueError, "JobQueue is closed");
+		goto fail;
+	}
+	if (job->mode_id < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown mode '%s'", mode_name);
+		goto fail;
+	}
+	if (mode != ENCRYPT && mode != DECRYPT) {
+		PyErr_SetString(PyExc_ValueError, "mode_in MUST be 0(encrypt) or 1(decrypt)");
+		goto fail;
+	}
+	if (parse_iv(job->mode_id, iv_obj, job->iv) < 0) {
+		goto fail;
+	}
+
+	module_state *st = type_state((PyObject *)self);
+	job->be = load_backend(st);
+	key_schedule *ks = get_key_schedule(st, job->be, key_obj, &pj->ks);
+	if (ks == NULL) {
+		goto fail;
+	}
+	// a Key object already has dk, so this only ever builds it in pj->ks
+	if (mode == DECRYPT && modes[job->mode_id].uses_inverse) {
+		prepare_decrypt(job->be, ks);
+	}
+	if (ks != &pj->ks) {
+		pj->ks = *ks;
+	}
+	job->ks = &pj->ks;
+
+	pj->result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)job->len);
+	if (pj->result == NULL) {
+		goto fail;
+	}
+	job->out = (unsigned char *)PyBytes_AS_STRING(pj->result);
+
+	if (job_queue_submit(&self->q, job) < 0) {
+		PyErr_SetString(PyExc_ValueError, "JobQueue is closed");
+		goto fail;
+	}
+	Py_RETURN_NONE;
+
+fail:
+	release_job(pj);
+	return NULL;
+}
+
+static PyObject* JobQueue_completed(JobQueueObject *self, PyObject *unused) {
+	if (!self->open) {
+		return PyList_New(0);
+	}
+	return finished_jobs(job_queue_take_done(&self->q));
+}
+
+// the workers stop here, but the queue's lock lives on until dealloc, so
+// submit() and completed() racing a close() still find it in one piece
+static PyObject* JobQueue_close(JobQueueObject *self, PyObject *unused) {
+	if (!self->open || !claim(&self->closed)) {
+		return PyList_New(0);
+	}
+	Py_BEGIN_ALLOW_THREADS
+	job_queue_stop(&self->q);
+	Py_END_ALLOW_THREADS
+	return finished_jobs(job_queue_take_done(&self->q));
+}
+
+static void JobQueue_dealloc(JobQueueObject *self) {
+	if (self->open) {
+		if (claim(&self->closed)) {
+			job_queue_stop(&self->q);
+		}
+		Py_XDECREF(finished_jobs(job_queue_free(&self->q)));
+	}
+	heap_dealloc((PyObject *)self);
+}
+
+static PyMethodDef JobQueue_methods[] = {
+	{ "submit", (PyCFunction)JobQueue_submit, METH_VARARGS | METH_KEYWORDS,
+		"submit(tag, mode_name, key, iv, data, mode) -> queues a mode call on the whole blocks of data, as the mode's bulk "
+		"function would; iv is the nonce for ctr and ignored for ecb" },
+	{ "completed", (PyCFunction)JobQueue_completed, METH_NOARGS,
+		"completed() -> [(tag, result)] for every job finished since the last call" },
+	{ "close", (PyCFunction)JobQueue_close, METH_NOARGS,
+		"close() -> finishes the queued jobs, stops the workers and returns what completed() would" },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyType_Slot JobQueue_slots[] = {
+	{ Py_tp_doc, "JobQueue(wakeup, workers=0) -> mode calls run on worker threads; wakeup is the fileno() "
+		"of a non-blocking socket or pipe written to when results are ready, workers 0 for get_threads()" },
+	{ Py_tp_methods, JobQueue_methods },
+	{ Py_tp_new, PyType_GenericNew },
+	{ Py_tp_init, JobQueue_init },
+	{ Py_tp_dealloc, JobQueue_dealloc },
+	{ 0, NULL }
+};
+
+static PyType_Spec JobQueue_spec = {
+	"blockcipher.JobQueue", sizeof(JobQueueObject), 0, Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE, JobQueue_slots
+};
+
+static PyObject* list_backends(PyObject* self, PyObject* unused) {
+	PyObject *names = PyList_New(0);
+	if (names == NULL) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < num_backends; i++) {
+		if (!backend_supported(&backends[i])) {
+			continue;
+		}
+		PyObject *name = PyUnicode_FromString(backends[i].name);
+		if (name == NULL || PyList_Append(names, name) < 0) {
+			Py_XDECREF(name);
+			Py_DECREF(names);
+			return NULL;
+		}
+		Py_DECREF(name);
+	}
+
+	PyObject *result = PyList_AsTuple(names);
+	Py_DECREF(names);
+	return result;
+}
+
+static PyObject* get_backend(PyObject* self, PyObject* unused) {
+	return PyUnicode_FromString(load_backend(get_state(self))->name);
+}
+
+static PyObject* set_backend(PyObject* self, PyObject* args) {
+	const char *name;
+
+	if (!PyArg_ParseTuple(args, "s", &name)) {
+		return NULL;
+	}
+
+	const cipher_backend *be = find_backend(name);
+	if (be == NULL) {
+		PyErr_Format(PyExc_ValueError, "unknown backend '%s'", name);
+		return NULL;
+	}
+	if (!backend_supported(be)) {
+		PyErr_Format(PyExc_ValueError, "backend '%s' is not supported on this CPU", name);
+		return NULL;
+	}
+
+	setting_store_ptr(get_state(self)->backend, be);
+	Py_RETURN_NONE;
+}
+
+static PyObject* get_threads(PyObject* self, PyObject* unused) {
+	return PyLong_FromLong(load_pool_threads());
+}
+
+static PyObject* set_threads(PyObject* self, PyObject* args) {
+	int threads;
+
+	if (!PyArg_ParseTuple(args, "i", &threads)) {
+		return NULL;
+	}
+
+	if (threads <= 0) {
+		threads = cpu_count();
+	}
+	store_pool_threads(threads);
+	Py_RETURN_NONE;
+}
+
+static PyObject* get_parallel_threshold(PyObject* self, PyObject* unused) {
+	return PyLong_FromSize_t(load_parallel_threshold());
+}
+
+static PyObject* set_parallel_threshold(PyObject* self, PyObject* args) {
+	Py_ssize_t threshold;
+
+	if (!PyArg_ParseTuple(args, "n", &threshold)) {
+		return NULL;
+	}
+
+	if (threshold < 0) {
+		PyErr_SetString(PyExc_ValueError, "threshold must not be negative");
+		return NULL;
+	}
+	store_parallel_threshold((size_t)threshold);
+	Py_RETURN_NONE;
+}
+
+static PyObject* set_stats(PyObject* self, PyObject* args) {
+	int enabled;
+
+	if (!PyArg_ParseTuple(args, "p", &enabled)) {
+		return NULL;
+	}
+
+	store_stats_enabled(enabled);
+	Py_RETURN_NONE;
+}
+
+static PyObject* reset_stats(PyObject* self, PyObject* unused) {
+	stats_reset();
+	Py_RETURN_NONE;
+}
+
+// {bucket lower bound: count} for the buckets in use; bucket 0 starts at 0
+static PyObject* histogram_dict(const uint64_t *counts, int buckets) {
+	PyObject *dict = PyDict_New();
+	if (dict == NULL) {
+		return NULL;
+	}
+	for (int i = 0; i < buckets; i++) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		PyObject *low = PyLong_FromUnsignedLongLong(i == 0 ? 0 : (unsigned long long)1 << i);
+		PyObject *n = PyLong_FromUnsignedLongLong(counts[i]);
+		int err = low == NULL || n == NULL || PyDict_SetItem(dict, low, n) < 0;
+		Py_XDECREF(low);
+		Py_XDECREF(n);
+		if (err) {
+			Py_DECREF(dict);
+			return NULL;
+		}
+	}
+	return dict;
+}
+
+static PyObject* op_stats_dict(const op_stats *op) {
+	PyObject *sizes = histogram_dict(op->sizes, STAT_SIZE_BUCKETS);
+	PyObject *latency = histogram_dict(op->latency, STAT_TIME_BUCKETS);
+	PyObject *result = NULL;
+
+	if (sizes != NULL && latency != NULL) {
+		result = Py_BuildValue("{sKsKsKsOsO}", "calls", (unsigned long long)op->calls,
+			"bytes", (unsigned long long)op->bytes, "blocks", (unsigned long long)op->blocks,
+			"sizes", sizes, "latency_ns", latency);
+	}
+	Py_XDECREF(sizes);
+	Py_XDECREF(latency);
+	return result;
+}
+
+// {direction: counters} for the directions backend b has run mode m in
+static PyObject* mode_stats_dict(size_t b, int m) {
+	static const char *directions[2] = { "encrypt", "decrypt" };
+	PyObject *dict = PyDict_New();
+	if (dict == NULL) {
+		return NULL;
+	}
+
+	for (int d = 0; d < 2; d++) {
+		op_stats op;
+		stats_read(b, m, d, &op);
+		if (op.calls == 0) {
+			continue;
+		}
+		PyObject *counters = op_stats_dict(&op);
+		if (counters == NULL || PyDict_SetItemString(dict, directions[d], counters) < 0) {
+			Py_XDECREF(counters);
+			Py_DECREF(dict);
+			return NULL;
+		}
+		Py_DECREF(counters);
+	}
+	return dict;
+}
+
+static PyObject* backend_stats_dict(size_t b) {
+	PyObject *ops = PyDict_New();
+	if (ops == NULL) {
+		return NULL;
+	}
+
+	for (int m = 0; m < STAT_MODES; m++) {
+		PyObject *by_direction = mode_stats_dict(b, m);
+		if (by_direction == NULL ||
+				(PyDict_GET_SIZE(by_direction) > 0 && PyDict_SetItemString(ops, stat_mode_name(m), by_direction) < 0)) {
+			Py_XDECREF(by_direction);
+			Py_DECREF(ops);
+			return NULL;
+		}
+		Py_DECREF(by_direction);
+	}
+
+	PyObject *result = Py_BuildValue("{sKsKsO}",
+		"key_expansions", (unsigned long long)stats_key_expansions(b),
+		"key_inversions", (unsigned long long)stats_key_inversions(b), "ops", ops);
+	Py_DECREF(ops);
+	return result;
+}
+
+/**
+ * stats() -> {"enabled": bool, "backends": {name: {"key_expansions",
+ * "key_inversions", "ops": {mode: {direction: {"calls", "bytes", "blocks",
+ * "sizes", "latency_ns"}}}}}}. sizes and latency_ns map the lower bound of
+ * each power-of-two bucket to its call count
+**/
+static PyObject* stats(PyObject* self, PyObject* unused) {
+	PyObject *by_backend = PyDict_New();
+	if (by_backend == NULL) {
+		return NULL;
+	}
+
+	for (size_t b = 0; b < num_backends; b++) {
+		if (!backend_supported(&backends[b])) {
+			continue;
+		}
+		PyObject *entry = backend_stats_dict(b);
+		if (entry == NULL || PyDict_SetItemString(by_backend, backends[b].name, entry) < 0) {
+			Py_XDECREF(entry);
+			Py_DECREF(by_backend);
+			return NULL;
+		}
+		Py_DECREF(entry);
+	}
+
+	PyObject *result = Py_BuildValue("{sOsO}", "enabled", load_stats_enabled() ? Py_True : Py_False, "backends", by_backend);
+	Py_DECREF(by_backend);
+	return result;
 }
 
 static PyMethodDef blockcipher_funcs[] = {
 	{ "blockcipher", (PyCFunction)blockcipher, METH_VARARGS, NULL },
+	{ "encrypt", (PyCFunction)bulk_encrypt, METH_VARARGS | METH_KEYWORDS,
+		"encrypt(key, data, length=-1, out=None) -> bytes, or bytes written into out" },
+	{ "decrypt", (PyCFunction)bulk_decrypt, METH_VARARGS | METH_KEYWORDS,
+		"decrypt(key, data, length=-1, out=None) -> bytes, or bytes written into out" },
+	{ "ecb", (PyCFunction)ecb, METH_VARARGS | METH_KEYWORDS,
+		"ecb(key, data, mode, out=None) -> bytes, or bytes written into out" },
+	{ "cbc", (PyCFunction)cbc, METH_VARARGS | METH_KEYWORDS,
+		"cbc(key, iv, data, mode, out=None) -> bytes, or bytes written into out" },
+	{ "pcbc", (PyCFunction)pcbc, METH_VARARGS | METH_KEYWORDS,
+		"pcbc(key, iv, data, mode, out=None) -> bytes, or bytes written into out" },
+	{ "cfb", (PyCFunction)cfb, METH_VARARGS | METH_KEYWORDS,
+		"cfb(key, iv, data, mode, out=None) -> bytes, or bytes written into out" },
+	{ "ofb", (PyCFunction)ofb, METH_VARARGS | METH_KEYWORDS,
+		"ofb(key, iv, data, mode, out=None) -> bytes, or bytes written into out" },
+	{ "ctr", (PyCFunction)ctr, METH_VARARGS | METH_KEYWORDS,
+		"ctr(key, nonce, data, mode, out=None) -> bytes, or bytes written into out" },
+	{ "gcm_encrypt", (PyCFunction)gcm_encrypt, METH_VARARGS | METH_KEYWORDS,
+		"gcm_encrypt(key, iv, data, aad=b'') -> (ciphertext, tag); standard AES-GCM, iv is 12 bytes, tag is 16" },
+	{ "gcm_decrypt", (PyCFunction)gcm_decrypt, METH_VARARGS | METH_KEYWORDS,
+		"gcm_decrypt(key, iv, data, tag, aad=b'') -> plaintext; raises ValueError if the tag does not match" },
+	{ "xts_encrypt", (PyCFunction)xts_encrypt, METH_VARARGS | METH_KEYWORDS,
+		"xts_encrypt(key1, key2, data, sector_size, first_sector=0, out=None) -> bytes, or bytes written into out" },
+	{ "xts_decrypt", (PyCFunction)xts_decrypt, METH_VARARGS | METH_KEYWORDS,
+		"xts_decrypt(key1, key2, data, sector_size, first_sector=0, out=None) -> bytes, or bytes written into out" },
+	{ "ECBEncryptor", (PyCFunction)ecb_encryptor, METH_VARARGS | METH_KEYWORDS, "ECBEncryptor(key) -> StreamCipher" },
+	{ "ECBDecryptor", (PyCFunction)ecb_decryptor, METH_VARARGS | METH_KEYWORDS, "ECBDecryptor(key) -> StreamCipher" },
+	{ "CBCEncryptor", (PyCFunction)cbc_encryptor, METH_VARARGS | METH_KEYWORDS, "CBCEncryptor(key, iv) -> StreamCipher" },
+	{ "CBCDecryptor", (PyCFunction)cbc_decryptor, METH_VARARGS | METH_KEYWORDS, "CBCDecryptor(key, iv) -> StreamCipher" },
+	{ "PCBCEncryptor", (PyCFunction)pcbc_encryptor, METH_VARARGS | METH_KEYWORDS, "PCBCEncryptor(key, iv) -> StreamCipher" },
+	{ "PCBCDecryptor", (PyCFunction)pcbc_decryptor, METH_VARARGS | METH_KEYWORDS, "PCBCDecryptor(key, iv) -> StreamCipher" },
+	{ "CFBEncryptor", (PyCFunction)cfb_encryptor, METH_VARARGS | METH_KEYWORDS, "CFBEncryptor(key, iv) -> StreamCipher" },
+	{ "CFBDecryptor", (PyCFunction)cfb_decryptor, METH_VARARGS | METH_KEYWORDS, "CFBDecryptor(key, iv) -> StreamCipher" },
+	{ "OFBEncryptor", (PyCFunction)ofb_encryptor, METH_VARARGS | METH_KEYWORDS, "OFBEncryptor(key, iv) -> StreamCipher" },
+	{ "OFBDecryptor", (PyCFunction)ofb_decryptor, METH_VARARGS | METH_KEYWORDS, "OFBDecryptor(key, iv) -> StreamCipher" },
+	{ "CTREncryptor", (PyCFunction)ctr_encryptor, METH_VARARGS | METH_KEYWORDS, "CTREncryptor(key, nonce) -> StreamCipher" },
+	{ "CTRDecryptor", (PyCFunction)ctr_decryptor, METH_VARARGS | METH_KEYWORDS, "CTRDecryptor(key, nonce) -> StreamCipher" },
+	{ "OFBKeystream", (PyCFunction)ofb_keystream, METH_VARARGS | METH_KEYWORDS,
+		"OFBKeystream(key, iv, lookahead=65536, background=True) -> Keystream" },
+	{ "CTRKeystream", (PyCFunction)ctr_keystream, METH_VARARGS | METH_KEYWORDS,
+		"CTRKeystream(key, nonce, lookahead=65536, background=True) -> Keystream" },
+	{ "encrypt_file", (PyCFunction)encrypt_file, METH_VARARGS | METH_KEYWORDS,
+		"encrypt_file(src, dst, mode, key, iv=None) -> bytes written; mode is a name like 'cbc', iv is the nonce for 'ctr'" },
+	{ "decrypt_file", (PyCFunction)decrypt_file, METH_VARARGS | METH_KEYWORDS,
+		"decrypt_file(src, dst, mode, key, iv=None) -> bytes written" },
+	{ "decrypt_range", (PyCFunction)decrypt_range, METH_VARARGS | METH_KEYWORDS,
+		"decrypt_range(mode_name, key, iv, data, offset, length, out=None) -> plaintext of data[offset:offset + length], "
+		"or bytes written into out; only the blocks covering the range are decrypted. ecb, cbc, cfb or ctr, iv is the nonce for ctr" },
+	{ "batch", (PyCFunction)batch, METH_VARARGS | METH_KEYWORDS,
+		"batch(mode_name, key, ivs, data, offsets, mode, out=None) -> bytes, or bytes written into out; "
+		"runs many messages packed in data, message i at data[offsets[i]:offsets[i + 1]] with a 16-byte iv in ivs" },
+	{ "backends", (PyCFunction)list_backends, METH_NOARGS, "backends() -> names of the available cipher backends" },
+	{ "get_backend", (PyCFunction)get_backend, METH_NOARGS, "get_backend() -> name of the backend in use" },
+	{ "set_backend", (PyCFunction)set_backend, METH_VARARGS, "set_backend(name) -> selects the backend every call runs on" },
+	{ "get_threads", (PyCFunction)get_threads, METH_NOARGS, "get_threads() -> threads large calls are split across" },
+	{ "set_threads", (PyCFunction)set_threads, METH_VARARGS, "set_threads(n) -> splits large calls across n threads, 0 for one per CPU" },
+	{ "get_parallel_threshold", (PyCFunction)get_parallel_threshold, METH_NOARGS,
+		"get_parallel_threshold() -> size in bytes below which calls stay on one thread" },
+	{ "set_parallel_threshold", (PyCFunction)set_parallel_threshold, METH_VARARGS,
+		"set_parallel_threshold(nbytes) -> size in bytes below which calls stay on one thread" },
+	{ "set_stats", (PyCFunction)set_stats, METH_VARARGS,
+		"set_stats(enabled) -> turns the usage counters read by stats() on or off; off by default" },
+	{ "stats", (PyCFunction)stats, METH_NOARGS,
+		"stats() -> calls, bytes, blocks, size and latency histograms by backend, mode and direction, and key schedule counts" },
+	{ "reset_stats", (PyCFunction)reset_stats, METH_NOARGS, "reset_stats() -> zeroes every counter" },
 	{ NULL, NULL, 0, NULL }
 };
 
+static int blockcipher_exec(PyObject *m) {
+	module_state *st = get_state(m);
+
+	// the tables and the pool are shared by every interpreter and set up once
+	init_core();
+	st->backend = default_backend();
+
+	// BLOCKCIPHER_BACKEND pins a backend from the environment, e.g. for tests
+	const char *forced = getenv("BLOCKCIPHER_BACKEND");
+	if (forced != NULL && forced[0] != '\0') {
+		const cipher_backend *be = find_backend(forced);
+		if (be == NULL || !backend_supported(be)) {
+			PyErr_Format(PyExc_ImportError, "BLOCKCIPHER_BACKEND names an unavailable backend '%s'", forced);
+			return -1;
+		}
+		st->backend = be;
+	}
+
+	// BLOCKCIPHER_STATS=1 turns the counters on from the start
+	const char *counting = getenv("BLOCKCIPHER_STATS");
+	if (counting != NULL && counting[0] != '\0' && strcmp(counting, "0") != 0) {
+		store_stats_enabled(1);
+	}
+
+	st->key_type = (PyTypeObject *)PyType_FromModuleAndSpec(m, &Key_spec, NULL);
+	if (st->key_type == NULL || PyModule_AddObjectRef(m, "Key", (PyObject *)st->key_type) < 0) {
+		return -1;
+	}
+	st->stream_type = (PyTypeObject *)PyType_FromModuleAndSpec(m, &Stream_spec, NULL);
+	if (st->stream_type == NULL || PyModule_AddObjectRef(m, "StreamCipher", (PyObject *)st->stream_type) < 0) {
+		return -1;
+	}
+	st->keystream_type = (PyTypeObject *)PyType_FromModuleAndSpec(m, &Keystream_spec, NULL);
+	if (st->keystream_type == NULL || PyModule_AddObjectRef(m, "Keystream", (PyObject *)st->keystream_type) < 0) {
+		return -1;
+	}
+	st->job_queue_type = (PyTypeObject *)PyType_FromModuleAndSpec(m, &JobQueue_spec, NULL);
+	if (st->job_queue_type == NULL || PyModule_AddObjectRef(m, "JobQueue", (PyObject *)st->job_queue_type) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static int blockcipher_traverse(PyObject *m, visitproc visit, void *arg) {
+	module_state *st = get_state(m);
+	Py_VISIT(st->key_type);
+	Py_VISIT(st->stream_type);
+	Py_VISIT(st->keystream_type);
+	Py_VISIT(st->job_queue_type);
+	return 0;
+}
+
+static int blockcipher_clear(PyObject *m) {
+	module_state *st = get_state(m);
+	Py_CLEAR(st->key_type);
+	Py_CLEAR(st->stream_type);
+	Py_CLEAR(st->keystream_type);
+	Py_CLEAR(st->job_queue_type);
+	return 0;
+}
+
+static void blockcipher_free(void *m) {
+	blockcipher_clear((PyObject *)m);
+}
+
+/**
+ * Multi-phase init: each interpreter gets its own module object and state.
+ * Nothing here leans on the GIL; every call works on its own buffers, Key
+ * objects are read-only once built, and the stream objects claim themselves
+ * atomically for each call
+**/
+static PyModuleDef_Slot blockcipher_slots[] = {
+	{ Py_mod_exec, blockcipher_exec },
+#ifdef Py_mod_multiple_interpreters
+	{ Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+#ifdef Py_mod_gil
+	{ Py_mod_gil, Py_MOD_GIL_NOT_USED },
+#endif
+	{ 0, NULL }
+};
+
 static struct PyModuleDef blockciphermodule = {
 	PyModuleDef_HEAD_INIT,
-	"blockcipher",
-	NULL,
-	-1,
-	blockcipher_funcs
+	.m_name = "blockcipher",
+	.m_size = sizeof(module_state),
+	.m_methods = blockcipher_funcs,
+	.m_slots = blockcipher_slots,
+	.m_traverse = blockcipher_traverse,
+	.m_clear = blockcipher_clear,
+	.m_free = blockcipher_free,
 };
 
 PyMODINIT_FUNC PyInit_blockcipher(void) {
-	return PyModule_Create(&blockciphermodule);
+	return PyModuleDef_Init(&blockciphermodule);
 }
@@ -0,0 +1,3272 @@
+/**
+ * The cipher core: key schedules, the cipher backends, the chaining modes,
+ * GCM, XTS and the worker pool. Shared by the Python module and bccrypt,
+ * so nothing in here touches Python
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "blockcipher_core.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HAVE_AESNI 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AESNI
+#else
+#include <cpuid.h>
+#define TARGET_AESNI __attribute__((target("aes,ssse3,pclmul")))
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define ALWAYS_INLINE static __forceinline
+#define UNROLL_ROUNDS
+#else
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+#define UNROLL_ROUNDS _Pragma("GCC unroll 16")
+#endif
+
+int rounds_for_key(int key_size) {
+	switch (key_size) {
+	case 16: return ROUNDS_128;
+	case 24: return ROUNDS_192;
+	case 32: return ROUNDS_256;
+	default: return 0;
+	}
+}
+
+/**
+ * Runs fn(nr, ...) with the schedule's round count as a compile-time
+ * constant. fn is force-inlined, so each key size gets its own fully
+ * unrolled copy of the round loop and the size is tested once per call
+ * rather than once per round
+**/
+#define WITH_ROUNDS(ks, fn, ...) \
+	switch ((ks)->rounds) { \
+	case ROUNDS_128: fn(ROUNDS_128, __VA_ARGS__); break; \
+	case ROUNDS_192: fn(ROUNDS_192, __VA_ARGS__); break; \
+	default:         fn(ROUNDS_256, __VA_ARGS__); break; \
+	}
+
+/**
+ * All lookup tables from https://cryptography.fandom.com/wiki/Rijndael_mix_columns
+*/
+
+static const unsigned char s[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
+
+static const unsigned char inv_s[256] = {
+	0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+	0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+	0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+	0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+	0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+	0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+	0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+	0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+	0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+	0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+	0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+	0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+	0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+	0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+	0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+	0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d};
+
+static const unsigned char rcon[255] = { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+static const unsigned char galois_2[256] = {
+	0x00,0x02,0x04,0x06,0x08,0x0a,0x0c,0x0e,0x10,0x12,0x14,0x16,0x18,0x1a,0x1c,0x1e,
+	0x20,0x22,0x24,0x26,0x28,0x2a,0x2c,0x2e,0x30,0x32,0x34,0x36,0x38,0x3a,0x3c,0x3e,
+	0x40,0x42,0x44,0x46,0x48,0x4a,0x4c,0x4e,0x50,0x52,0x54,0x56,0x58,0x5a,0x5c,0x5e,
+	0x60,0x62,0x64,0x66,0x68,0x6a,0x6c,0x6e,0x70,0x72,0x74,0x76,0x78,0x7a,0x7c,0x7e,
+	0x80,0x82,0x84,0x86,0x88,0x8a,0x8c,0x8e,0x90,0x92,0x94,0x96,0x98,0x9a,0x9c,0x9e,
+	0xa0,0xa2,0xa4,0xa6,0xa8,0xaa,0xac,0xae,0xb0,0xb2,0xb4,0xb6,0xb8,0xba,0xbc,0xbe,
+	0xc0,0xc2,0xc4,0xc6,0xc8,0xca,0xcc,0xce,0xd0,0xd2,0xd4,0xd6,0xd8,0xda,0xdc,0xde,
+	0xe0,0xe2,0xe4,0xe6,0xe8,0xea,0xec,0xee,0xf0,0xf2,0xf4,0xf6,0xf8,0xfa,0xfc,0xfe,
+	0x1b,0x19,0x1f,0x1d,0x13,0x11,0x17,0x15,0x0b,0x09,0x0f,0x0d,0x03,0x01,0x07,0x05,
+	0x3b,0x39,0x3f,0x3d,0x33,0x31,0x37,0x35,0x2b,0x29,0x2f,0x2d,0x23,0x21,0x27,0x25,
+	0x5b,0x59,0x5f,0x5d,0x53,0x51,0x57,0x55,0x4b,0x49,0x4f,0x4d,0x43,0x41,0x47,0x45,
+	0x7b,0x79,0x7f,0x7d,0x73,0x71,0x77,0x75,0x6b,0x69,0x6f,0x6d,0x63,0x61,0x67,0x65,
+	0x9b,0x99,0x9f,0x9d,0x93,0x91,0x97,0x95,0x8b,0x89,0x8f,0x8d,0x83,0x81,0x87,0x85,
+	0xbb,0xb9,0xbf,0xbd,0xb3,0xb1,0xb7,0xb5,0xab,0xa9,0xaf,0xad,0xa3,0xa1,0xa7,0xa5,
+	0xdb,0xd9,0xdf,0xdd,0xd3,0xd1,0xd7,0xd5,0xcb,0xc9,0xcf,0xcd,0xc3,0xc1,0xc7,0xc5,
+	0xfb,0xf9,0xff,0xfd,0xf3,0xf1,0xf7,0xf5,0xeb,0xe9,0xef,0xed,0xe3,0xe1,0xe7,0xe5};
+
+static const unsigned char galois_3[256] = {
+	0x00,0x03,0x06,0x05,0x0c,0x0f,0x0a,0x09,0x18,0x1b,0x1e,0x1d,0x14,0x17,0x12,0x11,
+	0x30,0x33,0x36,0x35,0x3c,0x3f,0x3a,0x39,0x28,0x2b,0x2e,0x2d,0x24,0x27,0x22,0x21,
+	0x60,0x63,0x66,0x65,0x6c,0x6f,0x6a,0x69,0x78,0x7b,0x7e,0x7d,0x74,0x77,0x72,0x71,
+	0x50,0x53,0x56,0x55,0x5c,0x5f,0x5a,0x59,0x48,0x4b,0x4e,0x4d,0x44,0x47,0x42,0x41,
+	0xc0,0xc3,0xc6,0xc5,0xcc,0xcf,0xca,0xc9,0xd8,0xdb,0xde,0xdd,0xd4,0xd7,0xd2,0xd1,
+	0xf0,0xf3,0xf6,0xf5,0xfc,0xff,0xfa,0xf9,0xe8,0xeb,0xee,0xed,0xe4,0xe7,0xe2,0xe1,
+	0xa0,0xa3,0xa6,0xa5,0xac,0xaf,0xaa,0xa9,0xb8,0xbb,0xbe,0xbd,0xb4,0xb7,0xb2,0xb1,
+	0x90,0x93,0x96,0x95,0x9c,0x9f,0x9a,0x99,0x88,0x8b,0x8e,0x8d,0x84,0x87,0x82,0x81,
+	0x9b,0x98,0x9d,0x9e,0x97,0x94,0x91,0x92,0x83,0x80,0x85,0x86,0x8f,0x8c,0x89,0x8a,
+	0xab,0xa8,0xad,0xae,0xa7,0xa4,0xa1,0xa2,0xb3,0xb0,0xb5,0xb6,0xbf,0xbc,0xb9,0xba,
+	0xfb,0xf8,0xfd,0xfe,0xf7,0xf4,0xf1,0xf2,0xe3,0xe0,0xe5,0xe6,0xef,0xec,0xe9,0xea,
+	0xcb,0xc8,0xcd,0xce,0xc7,0xc4,0xc1,0xc2,0xd3,0xd0,0xd5,0xd6,0xdf,0xdc,0xd9,0xda,
+	0x5b,0x58,0x5d,0x5e,0x57,0x54,0x51,0x52,0x43,0x40,0x45,0x46,0x4f,0x4c,0x49,0x4a,
+	0x6b,0x68,0x6d,0x6e,0x67,0x64,0x61,0x62,0x73,0x70,0x75,0x76,0x7f,0x7c,0x79,0x7a,
+	0x3b,0x38,0x3d,0x3e,0x37,0x34,0x31,0x32,0x23,0x20,0x25,0x26,0x2f,0x2c,0x29,0x2a,
+	0x0b,0x08,0x0d,0x0e,0x07,0x04,0x01,0x02,0x13,0x10,0x15,0x16,0x1f,0x1c,0x19,0x1a};
+
+static const unsigned char galois_9[256] = {
+	0x00,0x09,0x12,0x1b,0x24,0x2d,0x36,0x3f,0x48,0x41,0x5a,0x53,0x6c,0x65,0x7e,0x77,
+	0x90,0x99,0x82,0x8b,0xb4,0xbd,0xa6,0xaf,0xd8,0xd1,0xca,0xc3,0xfc,0xf5,0xee,0xe7,
+	0x3b,0x32,0x29,0x20,0x1f,0x16,0x0d,0x04,0x73,0x7a,0x61,0x68,0x57,0x5e,0x45,0x4c,
+	0xab,0xa2,0xb9,0xb0,0x8f,0x86,0x9d,0x94,0xe3,0xea,0xf1,0xf8,0xc7,0xce,0xd5,0xdc,
+	0x76,0x7f,0x64,0x6d,0x52,0x5b,0x40,0x49,0x3e,0x37,0x2c,0x25,0x1a,0x13,0x08,0x01,
+	0xe6,0xef,0xf4,0xfd,0xc2,0xcb,0xd0,0xd9,0xae,0xa7,0xbc,0xb5,0x8a,0x83,0x98,0x91,
+	0x4d,0x44,0x5f,0x56,0x69,0x60,0x7b,0x72,0x05,0x0c,0x17,0x1e,0x21,0x28,0x33,0x3a,
+	0xdd,0xd4,0xcf,0xc6,0xf9,0xf0,0xeb,0xe2,0x95,0x9c,0x87,0x8e,0xb1,0xb8,0xa3,0xaa,
+	0xec,0xe5,0xfe,0xf7,0xc8,0xc1,0xda,0xd3,0xa4,0xad,0xb6,0xbf,0x80,0x89,0x92,0x9b,
+	0x7c,0x75,0x6e,0x67,0x58,0x51,0x4a,0x43,0x34,0x3d,0x26,0x2f,0x10,0x19,0x02,0x0b,
+	0xd7,0xde,0xc5,0xcc,0xf3,0xfa,0xe1,0xe8,0x9f,0x96,0x8d,0x84,0xbb,0xb2,0xa9,0xa0,
+	0x47,0x4e,0x55,0x5c,0x63,0x6a,0x71,0x78,0x0f,0x06,0x1d,0x14,0x2b,0x22,0x39,0x30,
+	0x9a,0x93,0x88,0x81,0xbe,0xb7,0xac,0xa5,0xd2,0xdb,0xc0,0xc9,0xf6,0xff,0xe4,0xed,
+	0x0a,0x03,0x18,0x11,0x2e,0x27,0x3c,0x35,0x42,0x4b,0x50,0x59,0x66,0x6f,0x74,0x7d,
+	0xa1,0xa8,0xb3,0xba,0x85,0x8c,0x97,0x9e,0xe9,0xe0,0xfb,0xf2,0xcd,0xc4,0xdf,0xd6,
+	0x31,0x38,0x23,0x2a,0x15,0x1c,0x07,0x0e,0x79,0x70,0x6b,0x62,0x5d,0x54,0x4f,0x46};
+
+static const unsigned char galois_b[256] = {
+	0x00,0x0b,0x16,0x1d,0x2c,0x27,0x3a,0x31,0x58,0x53,0x4e,0x45,0x74,0x7f,0x62,0x69,
+	0xb0,0xbb,0xa6,0xad,0x9c,0x97,0x8a,0x81,0xe8,0xe3,0xfe,0xf5,0xc4,0xcf,0xd2,0xd9,
+	0x7b,0x70,0x6d,0x66,0x57,0x5c,0x41,0x4a,0x23,0x28,0x35,0x3e,0x0f,0x04,0x19,0x12,
+	0xcb,0xc0,0xdd,0xd6,0xe7,0xec,0xf1,0xfa,0x93,0x98,0x85,0x8e,0xbf,0xb4,0xa9,0xa2,
+	0xf6,0xfd,0xe0,0xeb,0xda,0xd1,0xcc,0xc7,0xae,0xa5,0xb8,0xb3,0x82,0x89,0x94,0x9f,
+	0x46,0x4d,0x50,0x5b,0x6a,0x61,0x7c,0x77,0x1e,0x15,0x08,0x03,0x32,0x39,0x24,0x2f,
+	0x8d,0x86,0x9b,0x90,0xa1,0xaa,0xb7,0xbc,0xd5,0xde,0xc3,0xc8,0xf9,0xf2,0xef,0xe4,
+	0x3d,0x36,0x2b,0x20,0x11,0x1a,0x07,0x0c,0x65,0x6e,0x73,0x78,0x49,0x42,0x5f,0x54,
+	0xf7,0xfc,0xe1,0xea,0xdb,0xd0,0xcd,0xc6,0xaf,0xa4,0xb9,0xb2,0x83,0x88,0x95,0x9e,
+	0x47,0x4c,0x51,0x5a,0x6b,0x60,0x7d,0x76,0x1f,0x14,0x09,0x02,0x33,0x38,0x25,0x2e,
+	0x8c,0x87,0x9a,0x91,0xa0,0xab,0xb6,0xbd,0xd4,0xdf,0xc2,0xc9,0xf8,0xf3,0xee,0xe5,
+	0x3c,0x37,0x2a,0x21,0x10,0x1b,0x06,0x0d,0x64,0x6f,0x72,0x79,0x48,0x43,0x5e,0x55,
+	0x01,0x0a,0x17,0x1c,0x2d,0x26,0x3b,0x30,0x59,0x52,0x4f,0x44,0x75,0x7e,0x63,0x68,
+	0xb1,0xba,0xa7,0xac,0x9d,0x96,0x8b,0x80,0xe9,0xe2,0xff,0xf4,0xc5,0xce,0xd3,0xd8,
+	0x7a,0x71,0x6c,0x67,0x56,0x5d,0x40,0x4b,0x22,0x29,0x34,0x3f,0x0e,0x05,0x18,0x13,
+	0xca,0xc1,0xdc,0xd7,0xe6,0xed,0xf0,0xfb,0x92,0x99,0x84,0x8f,0xbe,0xb5,0xa8,0xa3};
+
+static const unsigned char galois_d[256] = {
+	0x00,0x0d,0x1a,0x17,0x34,0x39,0x2e,0x23,0x68,0x65,0x72,0x7f,0x5c,0x51,0x46,0x4b,
+	0xd0,0xdd,0xca,0xc7,0xe4,0xe9,0xfe,0xf3,0xb8,0xb5,0xa2,0xaf,0x8c,0x81,0x96,0x9b,
+	0xbb,0xb6,0xa1,0xac,0x8f,0x82,0x95,0x98,0xd3,0xde,0xc9,0xc4,0xe7,0xea,0xfd,0xf0,
+	0x6b,0x66,0x71,0x7c,0x5f,0x52,0x45,0x48,0x03,0x0e,0x19,0x14,0x37,0x3a,0x2d,0x20,
+	0x6d,0x60,0x77,0x7a,0x59,0x54,0x43,0x4e,0x05,0x08,0x1f,0x12,0x31,0x3c,0x2b,0x26,
+	0xbd,0xb0,0xa7,0xaa,0x89,0x84,0x93,0x9e,0xd5,0xd8,0xcf,0xc2,0xe1,0xec,0xfb,0xf6,
+	0xd6,0xdb,0xcc,0xc1,0xe2,0xef,0xf8,0xf5,0xbe,0xb3,0xa4,0xa9,0x8a,0x87,0x90,0x9d,
+	0x06,0x0b,0x1c,0x11,0x32,0x3f,0x28,0x25,0x6e,0x63,0x74,0x79,0x5a,0x57,0x40,0x4d,
+	0xda,0xd7,0xc0,0xcd,0xee,0xe3,0xf4,0xf9,0xb2,0xbf,0xa8,0xa5,0x86,0x8b,0x9c,0x91,
+	0x0a,0x07,0x10,0x1d,0x3e,0x33,0x24,0x29,0x62,0x6f,0x78,0x75,0x56,0x5b,0x4c,0x41,
+	0x61,0x6c,0x7b,0x76,0x55,0x58,0x4f,0x42,0x09,0x04,0x13,0x1e,0x3d,0x30,0x27,0x2a,
+	0xb1,0xbc,0xab,0xa6,0x85,0x88,0x9f,0x92,0xd9,0xd4,0xc3,0xce,0xed,0xe0,0xf7,0xfa,
+	0xb7,0xba,0xad,0xa0,0x83,0x8e,0x99,0x94,0xdf,0xd2,0xc5,0xc8,0xeb,0xe6,0xf1,0xfc,
+	0x67,0x6a,0x7d,0x70,0x53,0x5e,0x49,0x44,0x0f,0x02,0x15,0x18,0x3b,0x36,0x21,0x2c,
+	0x0c,0x01,0x16,0x1b,0x38,0x35,0x22,0x2f,0x64,0x69,0x7e,0x73,0x50,0x5d,0x4a,0x47,
+	0xdc,0xd1,0xc6,0xcb,0xe8,0xe5,0xf2,0xff,0xb4,0xb9,0xae,0xa3,0x80,0x8d,0x9a,0x97};
+
+static const unsigned char galois_e[256] = {
+	0x00,0x0e,0x1c,0x12,0x38,0x36,0x24,0x2a,0x70,0x7e,0x6c,0x62,0x48,0x46,0x54,0x5a,
+	0xe0,0xee,0xfc,0xf2,0xd8,0xd6,0xc4,0xca,0x90,0x9e,0x8c,0x82,0xa8,0xa6,0xb4,0xba,
+	0xdb,0xd5,0xc7,0xc9,0xe3,0xed,0xff,0xf1,0xab,0xa5,0xb7,0xb9,0x93,0x9d,0x8f,0x81,
+	0x3b,0x35,0x27,0x29,0x03,0x0d,0x1f,0x11,0x4b,0x45,0x57,0x59,0x73,0x7d,0x6f,0x61,
+	0xad,0xa3,0xb1,0xbf,0x95,0x9b,0x89,0x87,0xdd,0xd3,0xc1,0xcf,0xe5,0xeb,0xf9,0xf7,
+	0x4d,0x43,0x51,0x5f,0x75,0x7b,0x69,0x67,0x3d,0x33,0x21,0x2f,0x05,0x0b,0x19,0x17,
+	0x76,0x78,0x6a,0x64,0x4e,0x40,0x52,0x5c,0x06,0x08,0x1a,0x14,0x3e,0x30,0x22,0x2c,
+	0x96,0x98,0x8a,0x84,0xae,0xa0,0xb2,0xbc,0xe6,0xe8,0xfa,0xf4,0xde,0xd0,0xc2,0xcc,
+	0x41,0x4f,0x5d,0x53,0x79,0x77,0x65,0x6b,0x31,0x3f,0x2d,0x23,0x09,0x07,0x15,0x1b,
+	0xa1,0xaf,0xbd,0xb3,0x99,0x97,0x85,0x8b,0xd1,0xdf,0xcd,0xc3,0xe9,0xe7,0xf5,0xfb,
+	0x9a,0x94,0x86,0x88,0xa2,0xac,0xbe,0xb0,0xea,0xe4,0xf6,0xf8,0xd2,0xdc,0xce,0xc0,
+	0x7a,0x74,0x66,0x68,0x42,0x4c,0x5e,0x50,0x0a,0x04,0x16,0x18,0x32,0x3c,0x2e,0x20,
+	0xec,0xe2,0xf0,0xfe,0xd4,0xda,0xc8,0xc6,0x9c,0x92,0x80,0x8e,0xa4,0xaa,0xb8,0xb6,
+	0x0c,0x02,0x10,0x1e,0x34,0x3a,0x28,0x26,0x7c,0x72,0x60,0x6e,0x44,0x4a,0x58,0x56,
+	0x37,0x39,0x2b,0x25,0x0f,0x01,0x13,0x1d,0x47,0x49,0x5b,0x55,0x7f,0x71,0x63,0x6d,
+	0xd7,0xd9,0xcb,0xc5,0xef,0xe1,0xf3,0xfd,0xa7,0xa9,0xbb,0xb5,0x9f,0x91,0x83,0x8d};
+
+/**
+ * XOR's word, a, with word, b, and stores it in res
+**/
+static void xor(unsigned char *a, unsigned char *b, unsigned char* res) {
+	res[0] = a[0] ^ b[0];
+	res[1] = a[1] ^ b[1];
+	res[2] = a[2] ^ b[2];
+	res[3] = a[3] ^ b[3];
+}
+
+// SubWord, the S-box on each byte of a key schedule word in place
+typedef void (*sub_word_func)(unsigned char *word);
+
+static void sub_word_table(unsigned char *word) {
+	for (int b = 0; b < 4; b++) {
+		word[b] = s[word[b]];
+	}
+}
+
+static void g(unsigned char *in, unsigned char *res, int r, sub_word_func sub_word) {
+	// left circular shift
+	res[0] = in[1];
+	res[1] = in[2];
+	res[2] = in[3];
+	res[3] = in[0];
+
+	// byte substition
+	sub_word(res);
+
+	// xor with rcon
+	res[0] ^= rcon[r];
+}
+
+/**
+ * The key is a row-major 4 x Nk matrix, Nk = key_size / 4, so word i of
+ * the key is column i: key[i], key[Nk + i], key[2Nk + i], key[3Nk + i].
+ * Round keys are written out row-major, 16 bytes per round
+**/
+static void generate_round_keys(const unsigned char *key, int key_size, unsigned char *round_keys, sub_word_func sub_word) {
+	int nk = key_size / 4;
+	int words = rounds_for_key(key_size) * 4;
+	unsigned char w[MAX_ROUNDS * 4][4];
+	unsigned char temp[4];
+
+	/**
+	 * copying the key into the first nk words
+	**/
+	for (int i = 0; i < nk; i++) {
+		w[i][0] = key[i];
+		w[i][1] = key[nk + i];
+		w[i][2] = key[2 * nk + i];
+		w[i][3] = key[3 * nk + i];
+	}
+
+	/**
+	 * generating the rest, each word from the one before it and the one nk back
+	**/
+	for (int i = nk; i < words; i++) {
+		if (i % nk == 0) {
+			// g() rotates, substitutes and adds rcon for the (i/nk)th time
+			g(w[i - 1], temp, i / nk, sub_word);
+		} else if (nk > 6 && i % nk == 4) {
+			// 256-bit keys substitute halfway through each nk words as well
+			memcpy(temp, w[i - 1], 4);
+			sub_word(temp);
+		} else {
+			memcpy(temp, w[i - 1], 4);
+		}
+		xor(w[i - nk], temp, w[i]);
+	}
+
+	for (int i = 0; i < words; i++) {
+		for (int row = 0; row < 4; row++) {
+			round_keys[(i / 4) * STATE_SIZE + row * 4 + (i % 4)] = w[i][row];
+		}
+	}
+}
+
+static void add_round_key(unsigned char *state, unsigned char *round_keys, int round) {
+
+	int round_offset = round<<4;
+
+	for (int i = 0; i < STATE_SIZE; i++) {
+		state[i] ^= round_keys[round_offset + i];
+	}
+}
+
+static void sub_bytes(unsigned char *state) {
+	for (int i = 0; i < STATE_SIZE; i++) {
+		state[i] = s[(state[i]&0xf0) + (state[i]&0xf)];
+	}
+}
+
+static void inv_sub_bytes(unsigned char *state) {
+	for (int i = 0; i < STATE_SIZE; i++) {
+		state[i] = inv_s[(state[i]&0xf0) + (state[i]&0xf)];
+	}
+}
+
+static void shift_rows(unsigned char *state) {
+	unsigned char swap;
+
+	swap = state[4];
+	state[4] = state[5];
+	state[5] = state[6];
+	state[6] = state[7];
+	state[7] = swap;
+
+	swap = state[8];
+	state[ 8] = state[10];
+	state[10] = swap;
+	swap = state[9];
+	state[ 9] = state[11];
+	state[11] = swap;
+
+	swap = state[12];
+	state[12] = state[15];
+	state[15] = state[14];
+	state[14] = state[13];
+	state[13] = swap;
+}
+
+static void inv_shift_rows(unsigned char *state) {
+	unsigned char swap;
+
+	swap = state[4];
+	state[4] = state[7];
+	state[7] = state[6];
+	state[6] = state[5];
+	state[5] = swap;
+
+	swap = state[8];
+	state[ 8] = state[10];
+	state[10] = swap;
+	swap = state[9];
+	state[ 9] = state[11];
+	state[11] = swap;
+
+	swap = state[12];
+	state[12] = state[13];
+	state[13] = state[14];
+	state[14] = state[15];
+	state[15] = swap;
+}
+
+// mix columns algorithm from https://cryptography.fandom.com/wiki/Rijndael_mix_columns
+static void mix_columns(unsigned char *state) {
+	unsigned char a[4];
+
+	int current_column = 0;
+	while (current_column < 4) { // 4 columns in the state
+		a[0] = state[current_column +  0];
+		a[1] = state[current_column +  4];
+		a[2] = state[current_column +  8];
+		a[3] = state[current_column + 12];
+
+		state[current_column +  0] = galois_2[a[0]] ^ galois_3[a[1]] ^          a[2]  ^          a[3] ;
+		state[current_column +  4] =          a[0]  ^ galois_2[a[1]] ^ galois_3[a[2]] ^          a[3] ;
+		state[current_column +  8] =          a[0]  ^          a[1]  ^ galois_2[a[2]] ^ galois_3[a[3]];
+		state[current_column + 12] = galois_3[a[0]] ^          a[1]  ^          a[2]  ^ galois_2[a[3]];
+
+		current_column += 1;
+	}
+}
+
+// inv_mix_columns algorithm from https://cryptography.fandom.com/wiki/Rijndael_mix_columns
+static void inv_mix_columns(unsigned char *state) {
+	unsigned char a[4];
+
+	int current_column = 0;
+	while (current_column < 4) { // 4 columns in the state
+		a[0] = state[current_column +  0];
+		a[1] = state[current_column +  4];
+		a[2] = state[current_column +  8];
+		a[3] = state[current_column + 12];
+
+		state[current_column +  0] = galois_e[a[0]] ^ galois_b[a[1]] ^ galois_d[a[2]] ^ galois_9[a[3]];
+		state[current_column +  4] = galois_9[a[0]] ^ galois_e[a[1]] ^ galois_b[a[2]] ^ galois_d[a[3]];
+		state[current_column +  8] = galois_d[a[0]] ^ galois_9[a[1]] ^ galois_e[a[2]] ^ galois_b[a[3]];
+		state[current_column + 12] = galois_b[a[0]] ^ galois_d[a[1]] ^ galois_9[a[2]] ^ galois_e[a[3]];
+
+		current_column += 1;
+	}
+}
+
+
+static void encrypt_block_cipher(const key_schedule *ks, const unsigned char *input, unsigned char *state) {
+	unsigned char *round_keys = (unsigned char *)ks->round_keys;
+
+	// first state is input
+	for (int i = 0; i < STATE_SIZE; i++) {
+		state[i] = input[i];
+	}
+
+	int current_round = 0;
+
+	// round 0, just add_round_key
+	add_round_key(state, round_keys, current_round);
+	current_round += 1;
+
+	// last round is different
+	while (current_round < ks->rounds - 1) {
+			sub_bytes(state);
+			shift_rows(state);
+			mix_columns(state);
+			add_round_key(state, round_keys, current_round);
+
+			current_round += 1;
+	}
+
+	//final round
+	sub_bytes(state);
+	shift_rows(state);
+	add_round_key(state, round_keys, current_round);
+}
+
+// the inverse cipher walks the encryption schedule backwards, so there is
+// no separate decryption schedule to build
+static void decrypt_block_cipher(const key_schedule *ks, const unsigned char *input, unsigned char *state) {
+	unsigned char *round_keys = (unsigned char *)ks->round_keys;
+
+	// first state is input
+	for (int i = 0; i < STATE_SIZE; i++) {
+		state[i] = input[i];
+	}
+
+	int current_round = ks->rounds - 1;
+
+	// round 0 == add_round_key()
+	add_round_key(state, round_keys, current_round);
+	current_round -= 1;
+
+	while (current_round > 0) {
+		inv_shift_rows(state);
+		inv_sub_bytes(state);
+		add_round_key(state, round_keys, current_round);
+		inv_mix_columns(state);
+
+		current_round -= 1;
+	}
+
+	inv_shift_rows(state);
+	inv_sub_bytes(state);
+	add_round_key(state, round_keys, current_round);
+}
+
+/**
+ * Table cipher: SubBytes, ShiftRows and MixColumns fused into four 32-bit
+ * lookups per column. The state is held as one word per column, row 0 in
+ * the low byte, so column c of a block is bytes c, 4+c, 8+c, 12+c
+**/
+
+static uint32_t te[4][256];
+static uint32_t td[4][256];
+
+#define ROTL8(w) (((w) << 8) | ((w) >> 24))
+
+#define BYTE0(w) ((w) & 0xff)
+#define BYTE1(w) (((w) >> 8) & 0xff)
+#define BYTE2(w) (((w) >> 16) & 0xff)
+#define BYTE3(w) ((w) >> 24)
+
+// builds te/td from the s-boxes and galois tables above, called once at import
+void init_tables(void) {
+	for (int i = 0; i < 256; i++) {
+		uint32_t e = (uint32_t)galois_2[s[i]] | ((uint32_t)s[i] << 8) | ((uint32_t)s[i] << 16) | ((uint32_t)galois_3[s[i]] << 24);
+		uint32_t d = (uint32_t)galois_e[inv_s[i]] | ((uint32_t)galois_9[inv_s[i]] << 8)
+			| ((uint32_t)galois_d[inv_s[i]] << 16) | ((uint32_t)galois_b[inv_s[i]] << 24);
+
+		for (int t = 0; t < 4; t++) {
+			te[t][i] = e;
+			td[t][i] = d;
+			e = ROTL8(e);
+			d = ROTL8(d);
+		}
+	}
+}
+
+static uint32_t load_column(const unsigned char *block, int c) {
+	return (uint32_t)block[c] | ((uint32_t)block[4 + c] << 8) | ((uint32_t)block[8 + c] << 16) | ((uint32_t)block[12 + c] << 24);
+}
+
+static void store_column(unsigned char *block, int c, uint32_t w) {
+	block[c]      = (unsigned char)w;
+	block[4 + c]  = (unsigned char)(w >> 8);
+	block[8 + c]  = (unsigned char)(w >> 16);
+	block[12 + c] = (unsigned char)(w >> 24);
+}
+
+// xtime on all four bytes of a column at once
+static uint32_t xtime_column(uint32_t w) {
+	return ((w & 0x7f7f7f7f) << 1) ^ (((w >> 7) & 0x01010101) * 0x1b);
+}
+
+static uint32_t rotate_column(uint32_t w, int bytes) {
+	return (w >> (8 * bytes)) | (w << (32 - 8 * bytes));
+}
+
+/**
+ * InvMixColumns of one column in arithmetic alone, without the table
+ * lookups that would leak the round keys through the cache: each pair of
+ * opposite bytes is premultiplied by {04}, which turns the inverse matrix
+ * into the forward one, then MixColumns is applied
+**/
+static uint32_t inv_mix_column(uint32_t w) {
+	uint32_t u = xtime_column(xtime_column(w));
+	w ^= u ^ rotate_column(u, 2);
+
+	uint32_t r1 = rotate_column(w, 1);
+	return xtime_column(w ^ r1) ^ r1 ^ rotate_column(w, 2) ^ rotate_column(w, 3);
+}
+
+static void bitslice_key(key_schedule *ks);
+
+// every backend's schedule, so a Key works whichever backend runs it
+static void expand_key_with(const unsigned char *key, int key_size, key_schedule *ks, sub_word_func sub_word) {
+	ks->key_size = key_size;
+	ks->rounds = rounds_for_key(key_size);
+	generate_round_keys(key, key_size, ks->round_keys, sub_word);
+
+	for (int r = 0; r < ks->rounds; r++) {
+		for (int c = 0; c < 4; c++) {
+			ks->ek[r * 4 + c] = load_column(ks->round_keys + r * STATE_SIZE, c);
+		}
+	}
+	bitslice_key(ks);
+	ks->dk_ready = 0;
+}
+
+static void expand_key(const unsigned char *key, int key_size, key_schedule *ks) {
+	expand_key_with(key, key_size, ks, sub_word_table);
+}
+
+/**
+ * Builds the equivalent inverse cipher schedule: the encryption round keys
+ * in reverse order with InvMixColumns applied to all but the outer two.
+ * Constant time, so every backend can run it on a key
+**/
+static void invert_key(key_schedule *ks) {
+	int nr = ks->rounds;
+
+	for (int r = 0; r < nr; r++) {
+		for (int c = 0; c < 4; c++) {
+			uint32_t w = ks->ek[(nr - 1 - r) * 4 + c];
+			ks->dk[r * 4 + c] = (r == 0 || r == nr - 1) ? w : inv_mix_column(w);
+		}
+	}
+}
+
+// one output column of a full round, a..d being the source columns after ShiftRows
+#define TE_COLUMN(a, b, c, d, k) \
+	(te[0][BYTE0(a)] ^ te[1][BYTE1(b)] ^ te[2][BYTE2(c)] ^ te[3][BYTE3(d)] ^ (k))
+#define TD_COLUMN(a, b, c, d, k) \
+	(td[0][BYTE0(a)] ^ td[1][BYTE1(b)] ^ td[2][BYTE2(c)] ^ td[3][BYTE3(d)] ^ (k))
+
+// one output column of the final round, which has no (Inv)MixColumns
+#define SBOX_COLUMN(box, a, b, c, d, k) \
+	(((uint32_t)box[BYTE0(a)] | ((uint32_t)box[BYTE1(b)] << 8) | ((uint32_t)box[BYTE2(c)] << 16) | ((uint32_t)box[BYTE3(d)] << 24)) ^ (k))
+
+#define TABLE_LANES 4 // blocks the table engine keeps in flight per pass
+
+ALWAYS_INLINE void encrypt_block_table_rounds(const int nr, const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	const uint32_t *rk = ks->ek;
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+	s0 = load_column(input, 0) ^ rk[0];
+	s1 = load_column(input, 1) ^ rk[1];
+	s2 = load_column(input, 2) ^ rk[2];
+	s3 = load_column(input, 3) ^ rk[3];
+
+	UNROLL_ROUNDS
+	for (int r = 1; r < nr - 1; r++) {
+		rk += 4;
+		t0 = TE_COLUMN(s0, s1, s2, s3, rk[0]);
+		t1 = TE_COLUMN(s1, s2, s3, s0, rk[1]);
+		t2 = TE_COLUMN(s2, s3, s0, s1, rk[2]);
+		t3 = TE_COLUMN(s3, s0, s1, s2, rk[3]);
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+
+	rk += 4;
+	store_column(output, 0, SBOX_COLUMN(s, s0, s1, s2, s3, rk[0]));
+	store_column(output, 1, SBOX_COLUMN(s, s1, s2, s3, s0, rk[1]));
+	store_column(output, 2, SBOX_COLUMN(s, s2, s3, s0, s1, rk[2]));
+	store_column(output, 3, SBOX_COLUMN(s, s3, s0, s1, s2, rk[3]));
+}
+
+static void encrypt_block_table(const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	WITH_ROUNDS(ks, encrypt_block_table_rounds, ks, input, output);
+}
+
+// needs prepare_decrypt() to have run on ks
+ALWAYS_INLINE void decrypt_block_table_rounds(const int nr, const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	const uint32_t *rk = ks->dk;
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+	s0 = load_column(input, 0) ^ rk[0];
+	s1 = load_column(input, 1) ^ rk[1];
+	s2 = load_column(input, 2) ^ rk[2];
+	s3 = load_column(input, 3) ^ rk[3];
+
+	UNROLL_ROUNDS
+	for (int r = 1; r < nr - 1; r++) {
+		rk += 4;
+		t0 = TD_COLUMN(s0, s3, s2, s1, rk[0]);
+		t1 = TD_COLUMN(s1, s0, s3, s2, rk[1]);
+		t2 = TD_COLUMN(s2, s1, s0, s3, rk[2]);
+		t3 = TD_COLUMN(s3, s2, s1, s0, rk[3]);
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+
+	rk += 4;
+	store_column(output, 0, SBOX_COLUMN(inv_s, s0, s3, s2, s1, rk[0]));
+	store_column(output, 1, SBOX_COLUMN(inv_s, s1, s0, s3, s2, rk[1]));
+	store_column(output, 2, SBOX_COLUMN(inv_s, s2, s1, s0, s3, rk[2]));
+	store_column(output, 3, SBOX_COLUMN(inv_s, s3, s2, s1, s0, rk[3]));
+}
+
+static void decrypt_block_table(const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	WITH_ROUNDS(ks, decrypt_block_table_rounds, ks, input, output);
+}
+
+/**
+ * TABLE_LANES independent blocks stepped through each round together, so
+ * the lookups of one block overlap the latency of the others
+**/
+ALWAYS_INLINE void encrypt_blocks_table_rounds(const int nr, const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	for (; blocks >= TABLE_LANES; blocks -= TABLE_LANES, in += TABLE_LANES * STATE_SIZE, out += TABLE_LANES * STATE_SIZE) {
+		const uint32_t *rk = ks->ek;
+		uint32_t st[TABLE_LANES][4], t[TABLE_LANES][4];
+
+		for (int b = 0; b < TABLE_LANES; b++) {
+			for (int c = 0; c < 4; c++) {
+				st[b][c] = load_column(in + b * STATE_SIZE, c) ^ rk[c];
+			}
+		}
+
+		UNROLL_ROUNDS
+		for (int r = 1; r < nr - 1; r++) {
+			rk += 4;
+			for (int b = 0; b < TABLE_LANES; b++) {
+				t[b][0] = TE_COLUMN(st[b][0], st[b][1], st[b][2], st[b][3], rk[0]);
+				t[b][1] = TE_COLUMN(st[b][1], st[b][2], st[b][3], st[b][0], rk[1]);
+				t[b][2] = TE_COLUMN(st[b][2], st[b][3], st[b][0], st[b][1], rk[2]);
+				t[b][3] = TE_COLUMN(st[b][3], st[b][0], st[b][1], st[b][2], rk[3]);
+			}
+			memcpy(st, t, sizeof(st));
+		}
+
+		rk += 4;
+		for (int b = 0; b < TABLE_LANES; b++) {
+			unsigned char *o = out + b * STATE_SIZE;
+			store_column(o, 0, SBOX_COLUMN(s, st[b][0], st[b][1], st[b][2], st[b][3], rk[0]));
+			store_column(o, 1, SBOX_COLUMN(s, st[b][1], st[b][2], st[b][3], st[b][0], rk[1]));
+			store_column(o, 2, SBOX_COLUMN(s, st[b][2], st[b][3], st[b][0], st[b][1], rk[2]));
+			store_column(o, 3, SBOX_COLUMN(s, st[b][3], st[b][0], st[b][1], st[b][2], rk[3]));
+		}
+	}
+
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		encrypt_block_table_rounds(nr, ks, in, out);
+	}
+}
+
+static void encrypt_blocks_table(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	WITH_ROUNDS(ks, encrypt_blocks_table_rounds, ks, in, out, blocks);
+}
+
+ALWAYS_INLINE void decrypt_blocks_table_rounds(const int nr, const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	for (; blocks >= TABLE_LANES; blocks -= TABLE_LANES, in += TABLE_LANES * STATE_SIZE, out += TABLE_LANES * STATE_SIZE) {
+		const uint32_t *rk = ks->dk;
+		uint32_t st[TABLE_LANES][4], t[TABLE_LANES][4];
+
+		for (int b = 0; b < TABLE_LANES; b++) {
+			for (int c = 0; c < 4; c++) {
+				st[b][c] = load_column(in + b * STATE_SIZE, c) ^ rk[c];
+			}
+		}
+
+		UNROLL_ROUNDS
+		for (int r = 1; r < nr - 1; r++) {
+			rk += 4;
+			for (int b = 0; b < TABLE_LANES; b++) {
+				t[b][0] = TD_COLUMN(st[b][0], st[b][3], st[b][2], st[b][1], rk[0]);
+				t[b][1] = TD_COLUMN(st[b][1], st[b][0], st[b][3], st[b][2], rk[1]);
+				t[b][2] = TD_COLUMN(st[b][2], st[b][1], st[b][0], st[b][3], rk[2]);
+				t[b][3] = TD_COLUMN(st[b][3], st[b][2], st[b][1], st[b][0], rk[3]);
+			}
+			memcpy(st, t, sizeof(st));
+		}
+
+		rk += 4;
+		for (int b = 0; b < TABLE_LANES; b++) {
+			unsigned char *o = out + b * STATE_SIZE;
+			store_column(o, 0, SBOX_COLUMN(inv_s, st[b][0], st[b][3], st[b][2], st[b][1], rk[0]));
+			store_column(o, 1, SBOX_COLUMN(inv_s, st[b][1], st[b][0], st[b][3], st[b][2], rk[1]));
+			store_column(o, 2, SBOX_COLUMN(inv_s, st[b][2], st[b][1], st[b][0], st[b][3], rk[2]));
+			store_column(o, 3, SBOX_COLUMN(inv_s, st[b][3], st[b][2], st[b][1], st[b][0], rk[3]));
+		}
+	}
+
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		decrypt_block_table_rounds(nr, ks, in, out);
+	}
+}
+
+static void decrypt_blocks_table(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	WITH_ROUNDS(ks, decrypt_blocks_table_rounds, ks, in, out, blocks);
+}
+
+static void encrypt_blocks_reference(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		encrypt_block_cipher(ks, in, out);
+	}
+}
+
+static void decrypt_blocks_reference(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		decrypt_block_cipher(ks, in, out);
+	}
+}
+
+/**
+ * Bitsliced engine: the cipher as boolean operations on bit planes, with
+ * no tables and no data-dependent branches, so it runs in constant time.
+ * Its key schedule goes through the same S-box circuit. bitslice.h holds
+ * the rounds and is instantiated for plain 64-bit words here and for SSE2
+ * and AVX2 registers further down
+**/
+
+// spreads a block's four column words over the even bytes of two words, the ct64 layout
+static void bs_interleave_words(uint64_t *q0, uint64_t *q1, const uint32_t *w) {
+	uint64_t x[4];
+
+	for (int c = 0; c < 4; c++) {
+		x[c] = w[c];
+		x[c] = (x[c] | (x[c] << 16)) & 0x0000FFFF0000FFFFULL;
+		x[c] = (x[c] | (x[c] << 8)) & 0x00FF00FF00FF00FFULL;
+	}
+	*q0 = x[0] | (x[2] << 8);
+	*q1 = x[1] | (x[3] << 8);
+}
+
+static void bs_interleave_in(uint64_t *q0, uint64_t *q1, const unsigned char *block) {
+	uint32_t w[4];
+
+	for (int c = 0; c < 4; c++) {
+		w[c] = load_column(block, c);
+	}
+	bs_interleave_words(q0, q1, w);
+}
+
+static void bs_interleave_out(unsigned char *block, uint64_t q0, uint64_t q1) {
+	uint64_t x[4] = { q0, q1, q0 >> 8, q1 >> 8 };
+
+	for (int c = 0; c < 4; c++) {
+		x[c] &= 0x00FF00FF00FF00FFULL;
+		x[c] = (x[c] | (x[c] >> 8)) & 0x0000FFFF0000FFFFULL;
+		store_column(block, c, (uint32_t)x[c] | (uint32_t)(x[c] >> 16));
+	}
+}
+
+#define BS_WORD         uint64_t
+#define BS_NAME(x)      x##_bs64
+#define BS_TARGET
+#define BS_XOR(a, b)    ((a) ^ (b))
+#define BS_AND(a, b)    ((a) & (b))
+#define BS_NOT(a)       (~(a))
+#define BS_SHL(a, n)    ((a) << (n))
+#define BS_SHR(a, n)    ((a) >> (n))
+#define BS_ROTR32(a)    (((a) << 32) | ((a) >> 32))
+#define BS_SET1(x)      ((uint64_t)(x))
+#include "bitslice.h"
+#undef BS_WORD
+#undef BS_NAME
+#undef BS_TARGET
+#undef BS_XOR
+#undef BS_AND
+#undef BS_NOT
+#undef BS_SHL
+#undef BS_SHR
+#undef BS_ROTR32
+#undef BS_SET1
+
+// bk holds each round key as the bit planes of four copies of it, ready to XOR in
+static void bitslice_key(key_schedule *ks) {
+	for (int r = 0; r < ks->rounds; r++) {
+		uint64_t q[8];
+		bs_interleave_words(&q[0], &q[4], ks->ek + r * 4);
+		q[1] = q[2] = q[3] = q[0];
+		q[5] = q[6] = q[7] = q[4];
+		ortho_bs64(q);
+		memcpy(ks->bk + r * 8, q, sizeof(q));
+	}
+}
+
+/**
+ * The key schedule for the bitsliced backends: SubWord goes through the
+ * S-box circuit rather than s[], so expanding a key reads no table at a
+ * key-dependent index either. The word's four bytes sit in the low four
+ * bits of each bit plane
+**/
+static void sub_word_bs(unsigned char *word) {
+	uint64_t q[8] = { 0 };
+
+	for (int i = 0; i < 8; i++) {
+		for (int b = 0; b < 4; b++) {
+			q[i] |= (uint64_t)((word[b] >> i) & 1) << b;
+		}
+	}
+	sbox_bs64(q);
+	for (int b = 0; b < 4; b++) {
+		word[b] = 0;
+		for (int i = 0; i < 8; i++) {
+			word[b] |= (unsigned char)(((q[i] >> b) & 1) << i);
+		}
+	}
+}
+
+static void expand_key_bs(const unsigned char *key, int key_size, key_schedule *ks) {
+	expand_key_with(key, key_size, ks, sub_word_bs);
+}
+
+// single blocks go through the 64-bit engine whatever the width, it wastes the fewest lanes
+static void encrypt_block_bs(const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	crypt_batch_bs64(ks, input, output, 1, ENCRYPT);
+}
+
+static void decrypt_block_bs(const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	crypt_batch_bs64(ks, input, output, 1, DECRYPT);
+}
+
+static uint64_t load_be64(const unsigned char *p) {
+	uint64_t v = 0;
+	for (int i = 0; i < 8; i++) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static void store_be64(unsigned char *p, uint64_t v) {
+	for (int i = 7; i >= 0; i--) {
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+/**
+ * GHASH, the GF(2^128) hash GCM authenticates with. Each engine
+ * precomputes what it needs from the hash subkey H into a ghash_key
+**/
+// reduction of the four bits shifted out of the low end each step
+static const uint16_t ghash_last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/**
+ * Shoup's 4-bit tables: 16 multiples of H, so a multiply is 32 lookups
+ * and shifts instead of 128 conditional XORs
+**/
+static void ghash_init_table(ghash_key *gk, const unsigned char *h) {
+	uint64_t vh = load_be64(h);
+	uint64_t vl = load_be64(h + 8);
+
+	gk->hh[0] = gk->hl[0] = 0;
+	gk->hh[8] = vh;
+	gk->hl[8] = vl;
+	// H * x^k for the single-bit entries 4, 2, 1
+	for (int i = 4; i > 0; i >>= 1) {
+		uint64_t t = (vl & 1) * 0xe100000000000000ULL;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ t;
+		gk->hh[i] = vh;
+		gk->hl[i] = vl;
+	}
+	// every other entry is the XOR of its bits
+	for (int i = 2; i <= 8; i *= 2) {
+		for (int j = 1; j < i; j++) {
+			gk->hh[i + j] = gk->hh[i] ^ gk->hh[j];
+			gk->hl[i + j] = gk->hl[i] ^ gk->hl[j];
+		}
+	}
+}
+
+// x = x * H
+static void ghash_mult_table(const ghash_key *gk, unsigned char *x) {
+	unsigned char lo = x[15] & 0xf;
+	uint64_t zh = gk->hh[lo];
+	uint64_t zl = gk->hl[lo];
+
+	for (int i = 15; i >= 0; i--) {
+		unsigned char nibbles[2] = { x[i] & 0xf, x[i] >> 4 };
+		for (int n = (i == 15); n < 2; n++) {
+			unsigned char rem = zl & 0xf;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ ((uint64_t)ghash_last4[rem] << 48);
+			zh ^= gk->hh[nibbles[n]];
+			zl ^= gk->hl[nibbles[n]];
+		}
+	}
+	store_be64(x, zh);
+	store_be64(x + 8, zl);
+}
+
+static void ghash_table(const ghash_key *gk, unsigned char *x, const unsigned char *in, size_t blocks) {
+	for (; blocks > 0; blocks--, in += STATE_SIZE) {
+		for (int i = 0; i < STATE_SIZE; i++) {
+			x[i] ^= in[i];
+		}
+		ghash_mult_table(gk, x);
+	}
+}
+
+/**
+ * x = x * H one bit at a time, masking instead of branching or indexing,
+ * for the constant-time backends. Uses H as the table init stores it in
+ * hh[8] and hl[8]
+**/
+static void ghash_mult_ct(const ghash_key *gk, unsigned char *x) {
+	uint64_t vh = gk->hh[8], vl = gk->hl[8];
+	uint64_t zh = 0, zl = 0;
+
+	for (int i = 0; i < STATE_SIZE; i++) {
+		for (int b = 7; b >= 0; b--) {
+			uint64_t m = 0 - (uint64_t)((x[i] >> b) & 1);
+			uint64_t r = 0 - (vl & 1);
+			zh ^= vh & m;
+			zl ^= vl & m;
+			vl = (vh << 63) | (vl >> 1);
+			vh = (vh >> 1) ^ (0xe100000000000000ULL & r);
+		}
+	}
+	store_be64(x, zh);
+	store_be64(x + 8, zl);
+}
+
+static void ghash_ct(const ghash_key *gk, unsigned char *x, const unsigned char *in, size_t blocks) {
+	for (; blocks > 0; blocks--, in += STATE_SIZE) {
+		for (int i = 0; i < STATE_SIZE; i++) {
+			x[i] ^= in[i];
+		}
+		ghash_mult_ct(gk, x);
+	}
+}
+
+#define PARALLEL_BLOCKS 8  // blocks the AES-NI engine interleaves
+#define MODE_BATCH      32 // blocks batched per call for the modes without a chain dependency
+
+static void xor_block(const unsigned char *a, const unsigned char *b, unsigned char *res) {
+	for (int i = 0; i < STATE_SIZE; i++) {
+		res[i] = a[i] ^ b[i];
+	}
+}
+
+static uint32_t load_row(const unsigned char *block, int r) {
+	const unsigned char *p = block + 4 * r;
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store_row(unsigned char *block, int r, uint32_t w) {
+	unsigned char *p = block + 4 * r;
+	p[0] = (unsigned char)w;
+	p[1] = (unsigned char)(w >> 8);
+	p[2] = (unsigned char)(w >> 16);
+	p[3] = (unsigned char)(w >> 24);
+}
+
+/**
+ * Swaps rows and columns, between the module's byte order and FIPS-197's:
+ * single bytes are exchanged between rows 0 and 1 and rows 2 and 3, then
+ * byte pairs between rows 0 and 2 and rows 1 and 3, a word at a time. in
+ * and out may be the same
+**/
+static void transpose_state(const unsigned char *in, unsigned char *out) {
+	uint32_t a = load_row(in, 0), b = load_row(in, 1), c = load_row(in, 2), d = load_row(in, 3);
+	uint32_t t;
+
+	t = ((a >> 8) ^ b) & 0x00ff00ff; b ^= t; a ^= t << 8;
+	t = ((c >> 8) ^ d) & 0x00ff00ff; d ^= t; c ^= t << 8;
+	t = ((a >> 16) ^ c) & 0x0000ffff; c ^= t; a ^= t << 16;
+	t = ((b >> 16) ^ d) & 0x0000ffff; d ^= t; b ^= t << 16;
+
+	store_row(out, 0, a);
+	store_row(out, 1, b);
+	store_row(out, 2, c);
+	store_row(out, 3, d);
+}
+
+static void ecb_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	if (mode == ENCRYPT) {
+		be->encrypt_blocks(ks, in, out, blocks);
+	} else {
+		be->decrypt_blocks(ks, in, out, blocks);
+	}
+}
+
+static void cbc_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	unsigned char chain[STATE_SIZE];
+	unsigned char block[STATE_SIZE];
+	memcpy(chain, iv, STATE_SIZE);
+
+	if (mode == ENCRYPT) {
+		for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+			xor_block(in, chain, block);
+			be->encrypt(ks, block, chain);
+			memcpy(out, chain, STATE_SIZE);
+		}
+		return;
+	}
+
+	// decryption has no chain dependency, so blocks go through in batches
+	unsigned char saved[MODE_BATCH * STATE_SIZE];
+	while (blocks > 0) {
+		size_t n = blocks < MODE_BATCH ? blocks : MODE_BATCH;
+		memcpy(saved, in, n * STATE_SIZE);
+		be->decrypt_blocks(ks, saved, out, n);
+
+		xor_block(out, chain, out);
+		for (size_t i = 1; i < n; i++) {
+			xor_block(out + i * STATE_SIZE, saved + (i - 1) * STATE_SIZE, out + i * STATE_SIZE);
+		}
+		memcpy(chain, saved + (n - 1) * STATE_SIZE, STATE_SIZE);
+
+		blocks -= n;
+		in += n * STATE_SIZE;
+		out += n * STATE_SIZE;
+	}
+}
+
+static void pcbc_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	unsigned char chain[STATE_SIZE];
+	unsigned char block[STATE_SIZE];
+	unsigned char result[STATE_SIZE];
+	memcpy(chain, iv, STATE_SIZE);
+
+	for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+		memcpy(block, in, STATE_SIZE);
+		if (mode == ENCRYPT) {
+			xor_block(block, chain, result);
+			be->encrypt(ks, result, result);
+		} else {
+			be->decrypt(ks, block, result);
+			xor_block(result, chain, result);
+		}
+		// next chaining value is plaintext ^ ciphertext either way
+		xor_block(block, result, chain);
+		memcpy(out, result, STATE_SIZE);
+	}
+}
+
+static void cfb_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	unsigned char chain[STATE_SIZE];
+	unsigned char stream[STATE_SIZE];
+	memcpy(chain, iv, STATE_SIZE);
+
+	if (mode == ENCRYPT) {
+		for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+			be->encrypt(ks, chain, stream);
+			xor_block(in, stream, chain);
+			memcpy(out, chain, STATE_SIZE);
+		}
+		return;
+	}
+
+	// decryption's keystream is the iv and all but the last ciphertext block
+	unsigned char streams[MODE_BATCH * STATE_SIZE];
+	while (blocks > 0) {
+		size_t n = blocks < MODE_BATCH ? blocks : MODE_BATCH;
+		memcpy(streams, chain, STATE_SIZE);
+		memcpy(streams + STATE_SIZE, in, (n - 1) * STATE_SIZE);
+		memcpy(chain, in + (n - 1) * STATE_SIZE, STATE_SIZE);
+		be->encrypt_blocks(ks, streams, streams, n);
+
+		for (size_t i = 0; i < n; i++) {
+			xor_block(in + i * STATE_SIZE, streams + i * STATE_SIZE, out + i * STATE_SIZE);
+		}
+
+		blocks -= n;
+		in += n * STATE_SIZE;
+		out += n * STATE_SIZE;
+	}
+}
+
+static void ofb_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	unsigned char chain[STATE_SIZE];
+	memcpy(chain, iv, STATE_SIZE);
+
+	for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+		be->encrypt(ks, chain, chain);
+		xor_block(in, chain, out);
+	}
+}
+
+// adds one to a big-endian 128-bit counter block
+static void increment_counter(unsigned char *counter) {
+	for (int i = STATE_SIZE - 1; i >= 0; i--) {
+		if (++counter[i] != 0) {
+			break;
+		}
+	}
+}
+
+static void ctr_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	unsigned char counter[STATE_SIZE];
+	unsigned char streams[MODE_BATCH * STATE_SIZE];
+	memcpy(counter, iv, STATE_SIZE);
+
+	while (blocks > 0) {
+		size_t n = blocks < MODE_BATCH ? blocks : MODE_BATCH;
+		for (size_t i = 0; i < n; i++) {
+			memcpy(streams + i * STATE_SIZE, counter, STATE_SIZE);
+			increment_counter(counter);
+		}
+		be->encrypt_blocks(ks, streams, streams, n);
+
+		for (size_t i = 0; i < n; i++) {
+			xor_block(in + i * STATE_SIZE, streams + i * STATE_SIZE, out + i * STATE_SIZE);
+		}
+
+		blocks -= n;
+		in += n * STATE_SIZE;
+		out += n * STATE_SIZE;
+	}
+}
+
+const cipher_mode modes[] = {
+	{ "ecb",  1 },
+	{ "cbc",  1 },
+	{ "pcbc", 1 },
+	{ "cfb",  0 },
+	{ "ofb",  0 },
+	{ "ctr",  0 },
+};
+
+static const mode_func generic_modes[] = { ecb_crypt, cbc_crypt, pcbc_crypt, cfb_crypt, ofb_crypt, ctr_crypt };
+
+/**
+ * XTS (IEEE 1619) for storage sectors. Every sector is encrypted on its
+ * own: block j is masked before and after the cipher with the tweak
+ * E_K2(sector number) * x^j, and a sector that is not a whole number of
+ * blocks ends with ciphertext stealing. Keys are in the module's byte
+ * order, but the data is the standard byte string, so blocks are
+ * transposed around the cipher and the tweak arithmetic runs in the
+ * standard order. Tweaks are kept as two little-endian 64-bit words so
+ * doubling is a few branch-free word ops, and the blocks of a sector go
+ * through the cipher MODE_BATCH at a time
+**/
+static uint64_t load_le64(const unsigned char *p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static void store_le64(unsigned char *p, uint64_t v) {
+	for (int i = 0; i < 8; i++) {
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+// passed by value so the tweak stays in registers while masks are written through char pointers
+typedef struct {
+	uint64_t lo, hi;
+} xts_tweak;
+
+// multiplies the tweak by x in GF(2^128), reducing by x^128 + x^7 + x^2 + x + 1
+static xts_tweak xts_double(xts_tweak t) {
+	uint64_t carry = 0 - (t.hi >> 63);
+	t.hi = (t.hi << 1) | (t.lo >> 63);
+	t.lo = (t.lo << 1) ^ (carry & 0x87);
+	return t;
+}
+
+// res = a ^ b over len bytes, a multiple of 8, a word at a time
+static void xor_words(const unsigned char *a, const unsigned char *b, unsigned char *res, size_t len) {
+	for (size_t i = 0; i < len; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		x ^= y;
+		memcpy(res + i, &x, 8);
+	}
+}
+
+static void xts_mask(xts_tweak t, const unsigned char *in, unsigned char *out) {
+	unsigned char mask[STATE_SIZE];
+	store_le64(mask, t.lo);
+	store_le64(mask + 8, t.hi);
+	xor_block(in, mask, out);
+}
+
+// runs n standard-order blocks through the cipher in place
+static void xts_cipher(const cipher_backend *be, const key_schedule *ks, unsigned char *buf, size_t n, int mode) {
+	for (size_t i = 0; i < n; i++) {
+		transpose_state(buf + i * STATE_SIZE, buf + i * STATE_SIZE);
+	}
+	if (mode == ENCRYPT) {
+		be->encrypt_blocks(ks, buf, buf, n);
+	} else {
+		be->decrypt_blocks(ks, buf, buf, n);
+	}
+	for (size_t i = 0; i < n; i++) {
+		transpose_state(buf + i * STATE_SIZE, buf + i * STATE_SIZE);
+	}
+}
+
+// one block under tweak t, for the stolen pair at the end of a sector
+static void xts_block(const cipher_backend *be, const key_schedule *ks, xts_tweak t,
+		const unsigned char *in, unsigned char *out, int mode) {
+	unsigned char block[STATE_SIZE];
+	xts_mask(t, in, block);
+	xts_cipher(be, ks, block, 1, mode);
+	xts_mask(t, block, out);
+}
+
+static void xts_sector(const cipher_backend *be, const key_schedule *ks1, const key_schedule *ks2,
+		uint64_t sector, const unsigned char *in, unsigned char *out, size_t size, int mode) {
+	unsigned char buf[MODE_BATCH * STATE_SIZE];
+	unsigned char masks[MODE_BATCH * STATE_SIZE];
+	xts_tweak t;
+	size_t tail = size % STATE_SIZE;
+	// with a short tail the last whole block is stolen from, so it waits for the end
+	size_t blocks = size / STATE_SIZE - (tail > 0);
+
+	memset(buf, 0, STATE_SIZE);
+	store_le64(buf, sector);
+	xts_cipher(be, ks2, buf, 1, ENCRYPT);
+	t.lo = load_le64(buf);
+	t.hi = load_le64(buf + 8);
+
+	while (blocks > 0) {
+		size_t n = blocks < MODE_BATCH ? blocks : MODE_BATCH;
+		for (size_t i = 0; i < n; i++) {
+			store_le64(masks + i * STATE_SIZE, t.lo);
+			store_le64(masks + i * STATE_SIZE + 8, t.hi);
+			t = xts_double(t);
+		}
+		xor_words(in, masks, buf, n * STATE_SIZE);
+		xts_cipher(be, ks1, buf, n, mode);
+		xor_words(buf, masks, out, n * STATE_SIZE);
+
+		blocks -= n;
+		in += n * STATE_SIZE;
+		out += n * STATE_SIZE;
+	}
+
+	if (tail > 0) {
+		// in and out now point at the last whole block, followed by the tail bytes
+		xts_tweak next = xts_double(t);
+		unsigned char last[STATE_SIZE];
+		unsigned char stolen[STATE_SIZE];
+
+		// decryption undoes the final block first, so its tweak order is swapped
+		xts_block(be, ks1, mode == ENCRYPT ? t : next, in, last, mode);
+		memcpy(stolen, in + STATE_SIZE, tail);
+		memcpy(stolen + tail, last + tail, STATE_SIZE - tail);
+		memcpy(out + STATE_SIZE, last, tail);
+		xts_block(be, ks1, mode == ENCRYPT ? next : t, stolen, out, mode);
+	}
+}
+
+#ifdef HAVE_AESNI
+
+/**
+ * AES-NI engine. The instructions expect a column-major state, so blocks
+ * are transposed with one shuffle on the way in and out; ek and dk are
+ * already in that byte order. Chaining values stay transposed in registers
+ * between blocks
+**/
+
+#define TRANSPOSE_MASK _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15)
+
+// byte-swaps the two counter halves and transposes in one shuffle
+#define COUNTER_MASK   _mm_setr_epi8(7, 3, 15, 11, 6, 2, 14, 10, 5, 1, 13, 9, 4, 0, 12, 8)
+
+TARGET_AESNI static __m128i load_block_ni(const unsigned char *block) {
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)block), TRANSPOSE_MASK);
+}
+
+TARGET_AESNI static void store_block_ni(unsigned char *block, __m128i x) {
+	_mm_storeu_si128((__m128i *)block, _mm_shuffle_epi8(x, TRANSPOSE_MASK));
+}
+
+TARGET_AESNI ALWAYS_INLINE void load_keys_ni(const int nr, const uint32_t *words, __m128i *rk) {
+	for (int r = 0; r < nr; r++) {
+		rk[r] = _mm_loadu_si128((const __m128i *)(words + r * 4));
+	}
+}
+
+TARGET_AESNI ALWAYS_INLINE __m128i encrypt_ni(const int nr, const __m128i *rk, __m128i x) {
+	x = _mm_xor_si128(x, rk[0]);
+	UNROLL_ROUNDS
+	for (int r = 1; r < nr - 1; r++) {
+		x = _mm_aesenc_si128(x, rk[r]);
+	}
+	return _mm_aesenclast_si128(x, rk[nr - 1]);
+}
+
+TARGET_AESNI ALWAYS_INLINE __m128i decrypt_ni(const int nr, const __m128i *rk, __m128i x) {
+	x = _mm_xor_si128(x, rk[0]);
+	UNROLL_ROUNDS
+	for (int r = 1; r < nr - 1; r++) {
+		x = _mm_aesdec_si128(x, rk[r]);
+	}
+	return _mm_aesdeclast_si128(x, rk[nr - 1]);
+}
+
+/**
+ * PARALLEL_BLOCKS independent blocks through each round together, which
+ * keeps the AES unit's pipeline full instead of waiting out each round's
+ * latency
+**/
+TARGET_AESNI ALWAYS_INLINE void encrypt_parallel_ni(const int nr, const __m128i *rk, __m128i *x) {
+	for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+		x[b] = _mm_xor_si128(x[b], rk[0]);
+	}
+	UNROLL_ROUNDS
+	for (int r = 1; r < nr - 1; r++) {
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			x[b] = _mm_aesenc_si128(x[b], rk[r]);
+		}
+	}
+	for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+		x[b] = _mm_aesenclast_si128(x[b], rk[nr - 1]);
+	}
+}
+
+TARGET_AESNI ALWAYS_INLINE void decrypt_parallel_ni(const int nr, const __m128i *rk, __m128i *x) {
+	for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+		x[b] = _mm_xor_si128(x[b], rk[0]);
+	}
+	UNROLL_ROUNDS
+	for (int r = 1; r < nr - 1; r++) {
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			x[b] = _mm_aesdec_si128(x[b], rk[r]);
+		}
+	}
+	for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+		x[b] = _mm_aesdeclast_si128(x[b], rk[nr - 1]);
+	}
+}
+
+TARGET_AESNI static __m128i expand_step_ni(__m128i key, __m128i assist) {
+	assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+// aeskeygenassist takes rcon as an immediate, hence the unrolled schedule.
+// Longer keys are expanded once per Key, so they share the portable code
+TARGET_AESNI static void expand_key_ni(const unsigned char *key, int key_size, key_schedule *ks) {
+	__m128i rk[ROUNDS_128];
+
+	if (key_size != 16) {
+		expand_key_bs(key, key_size, ks);
+		return;
+	}
+
+	rk[0]  = load_block_ni(key);
+	rk[1]  = expand_step_ni(rk[0], _mm_aeskeygenassist_si128(rk[0], 0x01));
+	rk[2]  = expand_step_ni(rk[1], _mm_aeskeygenassist_si128(rk[1], 0x02));
+	rk[3]  = expand_step_ni(rk[2], _mm_aeskeygenassist_si128(rk[2], 0x04));
+	rk[4]  = expand_step_ni(rk[3], _mm_aeskeygenassist_si128(rk[3], 0x08));
+	rk[5]  = expand_step_ni(rk[4], _mm_aeskeygenassist_si128(rk[4], 0x10));
+	rk[6]  = expand_step_ni(rk[5], _mm_aeskeygenassist_si128(rk[5], 0x20));
+	rk[7]  = expand_step_ni(rk[6], _mm_aeskeygenassist_si128(rk[6], 0x40));
+	rk[8]  = expand_step_ni(rk[7], _mm_aeskeygenassist_si128(rk[7], 0x80));
+	rk[9]  = expand_step_ni(rk[8], _mm_aeskeygenassist_si128(rk[8], 0x1b));
+	rk[10] = expand_step_ni(rk[9], _mm_aeskeygenassist_si128(rk[9], 0x36));
+
+	for (int r = 0; r < ROUNDS_128; r++) {
+		_mm_storeu_si128((__m128i *)(ks->ek + r * 4), rk[r]);
+		store_block_ni(ks->round_keys + r * STATE_SIZE, rk[r]);
+	}
+	ks->key_size = key_size;
+	ks->rounds = ROUNDS_128;
+	bitslice_key(ks);
+	ks->dk_ready = 0;
+}
+
+TARGET_AESNI static void invert_key_ni(key_schedule *ks) {
+	int nr = ks->rounds;
+
+	for (int r = 0; r < nr; r++) {
+		__m128i w = _mm_loadu_si128((const __m128i *)(ks->ek + (nr - 1 - r) * 4));
+		if (r != 0 && r != nr - 1) {
+			w = _mm_aesimc_si128(w);
+		}
+		_mm_storeu_si128((__m128i *)(ks->dk + r * 4), w);
+	}
+}
+
+TARGET_AESNI ALWAYS_INLINE void encrypt_block_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	__m128i rk[MAX_ROUNDS];
+	load_keys_ni(nr, ks->ek, rk);
+	store_block_ni(output, encrypt_ni(nr, rk, load_block_ni(input)));
+}
+
+TARGET_AESNI static void encrypt_block_ni(const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	WITH_ROUNDS(ks, encrypt_block_ni_rounds, ks, input, output);
+}
+
+TARGET_AESNI ALWAYS_INLINE void decrypt_block_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	__m128i rk[MAX_ROUNDS];
+	load_keys_ni(nr, ks->dk, rk);
+	store_block_ni(output, decrypt_ni(nr, rk, load_block_ni(input)));
+}
+
+TARGET_AESNI static void decrypt_block_ni(const key_schedule *ks, const unsigned char *input, unsigned char *output) {
+	WITH_ROUNDS(ks, decrypt_block_ni_rounds, ks, input, output);
+}
+
+TARGET_AESNI ALWAYS_INLINE void encrypt_blocks_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i x[PARALLEL_BLOCKS];
+	load_keys_ni(nr, ks->ek, rk);
+
+	for (; blocks >= PARALLEL_BLOCKS; blocks -= PARALLEL_BLOCKS, in += PARALLEL_BLOCKS * STATE_SIZE, out += PARALLEL_BLOCKS * STATE_SIZE) {
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			x[b] = load_block_ni(in + b * STATE_SIZE);
+		}
+		encrypt_parallel_ni(nr, rk, x);
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			store_block_ni(out + b * STATE_SIZE, x[b]);
+		}
+	}
+
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		store_block_ni(out, encrypt_ni(nr, rk, load_block_ni(in)));
+	}
+}
+
+TARGET_AESNI static void encrypt_blocks_ni(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	WITH_ROUNDS(ks, encrypt_blocks_ni_rounds, ks, in, out, blocks);
+}
+
+TARGET_AESNI ALWAYS_INLINE void decrypt_blocks_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i x[PARALLEL_BLOCKS];
+	load_keys_ni(nr, ks->dk, rk);
+
+	for (; blocks >= PARALLEL_BLOCKS; blocks -= PARALLEL_BLOCKS, in += PARALLEL_BLOCKS * STATE_SIZE, out += PARALLEL_BLOCKS * STATE_SIZE) {
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			x[b] = load_block_ni(in + b * STATE_SIZE);
+		}
+		decrypt_parallel_ni(nr, rk, x);
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			store_block_ni(out + b * STATE_SIZE, x[b]);
+		}
+	}
+
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		store_block_ni(out, decrypt_ni(nr, rk, load_block_ni(in)));
+	}
+}
+
+TARGET_AESNI static void decrypt_blocks_ni(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks) {
+	WITH_ROUNDS(ks, decrypt_blocks_ni_rounds, ks, in, out, blocks);
+}
+
+TARGET_AESNI static void ecb_crypt_ni(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	if (mode == ENCRYPT) {
+		encrypt_blocks_ni(ks, in, out, blocks);
+	} else {
+		decrypt_blocks_ni(ks, in, out, blocks);
+	}
+}
+
+TARGET_AESNI ALWAYS_INLINE void cbc_crypt_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i chain = load_block_ni(iv);
+
+	if (mode == ENCRYPT) {
+		load_keys_ni(nr, ks->ek, rk);
+		for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+			chain = encrypt_ni(nr, rk, _mm_xor_si128(load_block_ni(in), chain));
+			store_block_ni(out, chain);
+		}
+		return;
+	}
+
+	load_keys_ni(nr, ks->dk, rk);
+	__m128i x[PARALLEL_BLOCKS];
+	__m128i c[PARALLEL_BLOCKS];
+
+	for (; blocks >= PARALLEL_BLOCKS; blocks -= PARALLEL_BLOCKS, in += PARALLEL_BLOCKS * STATE_SIZE, out += PARALLEL_BLOCKS * STATE_SIZE) {
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			c[b] = x[b] = load_block_ni(in + b * STATE_SIZE);
+		}
+		decrypt_parallel_ni(nr, rk, x);
+		store_block_ni(out, _mm_xor_si128(x[0], chain));
+		for (int b = 1; b < PARALLEL_BLOCKS; b++) {
+			store_block_ni(out + b * STATE_SIZE, _mm_xor_si128(x[b], c[b - 1]));
+		}
+		chain = c[PARALLEL_BLOCKS - 1];
+	}
+
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		__m128i block = load_block_ni(in);
+		store_block_ni(out, _mm_xor_si128(decrypt_ni(nr, rk, block), chain));
+		chain = block;
+	}
+}
+
+TARGET_AESNI static void cbc_crypt_ni(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	WITH_ROUNDS(ks, cbc_crypt_ni_rounds, ks, iv, in, out, blocks, mode);
+}
+
+TARGET_AESNI ALWAYS_INLINE void pcbc_crypt_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i chain = load_block_ni(iv);
+
+	if (mode == ENCRYPT) {
+		load_keys_ni(nr, ks->ek, rk);
+		for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+			__m128i block = load_block_ni(in);
+			__m128i result = encrypt_ni(nr, rk, _mm_xor_si128(block, chain));
+			chain = _mm_xor_si128(block, result);
+			store_block_ni(out, result);
+		}
+	} else {
+		load_keys_ni(nr, ks->dk, rk);
+		for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+			__m128i block = load_block_ni(in);
+			__m128i result = _mm_xor_si128(decrypt_ni(nr, rk, block), chain);
+			chain = _mm_xor_si128(block, result);
+			store_block_ni(out, result);
+		}
+	}
+}
+
+TARGET_AESNI static void pcbc_crypt_ni(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	WITH_ROUNDS(ks, pcbc_crypt_ni_rounds, ks, iv, in, out, blocks, mode);
+}
+
+TARGET_AESNI ALWAYS_INLINE void cfb_crypt_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i chain = load_block_ni(iv);
+	load_keys_ni(nr, ks->ek, rk);
+
+	if (mode == ENCRYPT) {
+		for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+			chain = _mm_xor_si128(encrypt_ni(nr, rk, chain), load_block_ni(in));
+			store_block_ni(out, chain);
+		}
+		return;
+	}
+
+	__m128i x[PARALLEL_BLOCKS];
+	__m128i c[PARALLEL_BLOCKS];
+
+	for (; blocks >= PARALLEL_BLOCKS; blocks -= PARALLEL_BLOCKS, in += PARALLEL_BLOCKS * STATE_SIZE, out += PARALLEL_BLOCKS * STATE_SIZE) {
+		x[0] = chain;
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			c[b] = load_block_ni(in + b * STATE_SIZE);
+			if (b + 1 < PARALLEL_BLOCKS) {
+				x[b + 1] = c[b];
+			}
+		}
+		encrypt_parallel_ni(nr, rk, x);
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			store_block_ni(out + b * STATE_SIZE, _mm_xor_si128(x[b], c[b]));
+		}
+		chain = c[PARALLEL_BLOCKS - 1];
+	}
+
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		__m128i block = load_block_ni(in);
+		store_block_ni(out, _mm_xor_si128(encrypt_ni(nr, rk, chain), block));
+		chain = block;
+	}
+}
+
+TARGET_AESNI static void cfb_crypt_ni(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	WITH_ROUNDS(ks, cfb_crypt_ni_rounds, ks, iv, in, out, blocks, mode);
+}
+
+TARGET_AESNI ALWAYS_INLINE void ofb_crypt_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i chain = load_block_ni(iv);
+	load_keys_ni(nr, ks->ek, rk);
+
+	for (size_t i = 0; i < blocks; i++, in += STATE_SIZE, out += STATE_SIZE) {
+		chain = encrypt_ni(nr, rk, chain);
+		store_block_ni(out, _mm_xor_si128(load_block_ni(in), chain));
+	}
+}
+
+TARGET_AESNI static void ofb_crypt_ni(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	WITH_ROUNDS(ks, ofb_crypt_ni_rounds, ks, iv, in, out, blocks, mode);
+}
+
+TARGET_AESNI ALWAYS_INLINE void ctr_crypt_ni_rounds(const int nr, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i x[PARALLEL_BLOCKS];
+	uint64_t hi = load_be64(iv);
+	uint64_t lo = load_be64(iv + 8);
+	load_keys_ni(nr, ks->ek, rk);
+
+	while (blocks > 0) {
+		size_t n = blocks < PARALLEL_BLOCKS ? blocks : PARALLEL_BLOCKS;
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			x[b] = _mm_shuffle_epi8(_mm_set_epi64x((long long)lo, (long long)hi), COUNTER_MASK);
+			if (++lo == 0) {
+				hi++;
+			}
+		}
+		encrypt_parallel_ni(nr, rk, x);
+		for (size_t b = 0; b < n; b++) {
+			store_block_ni(out + b * STATE_SIZE, _mm_xor_si128(load_block_ni(in + b * STATE_SIZE), x[b]));
+		}
+
+		blocks -= n;
+		in += n * STATE_SIZE;
+		out += n * STATE_SIZE;
+	}
+}
+
+TARGET_AESNI static void ctr_crypt_ni(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	WITH_ROUNDS(ks, ctr_crypt_ni_rounds, ks, iv, in, out, blocks, mode);
+}
+
+static const mode_func aesni_modes[] = { ecb_crypt_ni, cbc_crypt_ni, pcbc_crypt_ni, cfb_crypt_ni, ofb_crypt_ni, ctr_crypt_ni };
+
+/**
+ * XTS on AES-NI. The instructions already work in the standard byte
+ * order, so blocks are loaded without the transposing shuffle. Tweaks are
+ * doubled in an SSE register, a shift of each dword with the carries
+ * moved across by one shuffle. Sectors go through PARALLEL_BLOCKS blocks
+ * at a time like the other parallel paths
+**/
+TARGET_AESNI static __m128i xts_double_ni(__m128i t) {
+	__m128i carries = _mm_shuffle_epi32(_mm_srai_epi32(t, 31), _MM_SHUFFLE(2, 1, 0, 3));
+	carries = _mm_and_si128(carries, _mm_setr_epi32(0x87, 1, 1, 1));
+	return _mm_xor_si128(_mm_slli_epi32(t, 1), carries);
+}
+
+TARGET_AESNI ALWAYS_INLINE __m128i xts_block_ni(const int nr, const __m128i *rk, __m128i t, __m128i x, int mode) {
+	x = _mm_xor_si128(x, t);
+	x = mode == ENCRYPT ? encrypt_ni(nr, rk, x) : decrypt_ni(nr, rk, x);
+	return _mm_xor_si128(x, t);
+}
+
+TARGET_AESNI ALWAYS_INLINE void xts_sector_ni_rounds(const int nr, const key_schedule *ks1, const key_schedule *ks2,
+		uint64_t sector, const unsigned char *in, unsigned char *out, size_t size, int mode) {
+	__m128i rk[MAX_ROUNDS];
+	__m128i x[PARALLEL_BLOCKS];
+	__m128i tw[PARALLEL_BLOCKS];
+	unsigned char block[STATE_SIZE] = { 0 };
+	size_t tail = size % STATE_SIZE;
+	size_t blocks = size / STATE_SIZE - (tail > 0);
+
+	// ks2 may be a different size from ks1, so it goes through the dispatching call,
+	// which takes and returns the module's byte order
+	for (int i = 0; i < 8; i++) {
+		block[i] = (unsigned char)(sector >> (8 * i));
+	}
+	_mm_storeu_si128((__m128i *)block, load_block_ni(block));
+	encrypt_block_ni(ks2, block, block);
+	__m128i t = load_block_ni(block);
+	load_keys_ni(nr, mode == ENCRYPT ? ks1->ek : ks1->dk, rk);
+
+	for (; blocks >= PARALLEL_BLOCKS; blocks -= PARALLEL_BLOCKS, in += PARALLEL_BLOCKS * STATE_SIZE, out += PARALLEL_BLOCKS * STATE_SIZE) {
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			tw[b] = t;
+			t = xts_double_ni(t);
+			x[b] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + b * STATE_SIZE)), tw[b]);
+		}
+		if (mode == ENCRYPT) {
+			encrypt_parallel_ni(nr, rk, x);
+		} else {
+			decrypt_parallel_ni(nr, rk, x);
+		}
+		for (int b = 0; b < PARALLEL_BLOCKS; b++) {
+			x[b] = _mm_xor_si128(x[b], tw[b]);
+			_mm_storeu_si128((__m128i *)(out + b * STATE_SIZE), x[b]);
+		}
+	}
+
+	for (; blocks > 0; blocks--, in += STATE_SIZE, out += STATE_SIZE) {
+		__m128i y = xts_block_ni(nr, rk, t, _mm_loadu_si128((const __m128i *)in), mode);
+		_mm_storeu_si128((__m128i *)out, y);
+		t = xts_double_ni(t);
+	}
+
+	if (tail > 0) {
+		// the same stealing as xts_sector
+		__m128i next = xts_double_ni(t);
+		unsigned char last[STATE_SIZE];
+		unsigned char stolen[STATE_SIZE];
+
+		__m128i y = xts_block_ni(nr, rk, mode == ENCRYPT ? t : next, _mm_loadu_si128((const __m128i *)in), mode);
+		_mm_storeu_si128((__m128i *)last, y);
+		memcpy(stolen, in + STATE_SIZE, tail);
+		memcpy(stolen + tail, last + tail, STATE_SIZE - tail);
+		memcpy(out + STATE_SIZE, last, tail);
+		y = xts_block_ni(nr, rk, mode == ENCRYPT ? next : t, _mm_loadu_si128((const __m128i *)stolen), mode);
+		_mm_storeu_si128((__m128i *)out, y);
+	}
+}
+
+TARGET_AESNI static void xts_sector_ni(const cipher_backend *be, const key_schedule *ks1, const key_schedule *ks2,
+		uint64_t sector, const unsigned char *in, unsigned char *out, size_t size, int mode) {
+	WITH_ROUNDS(ks1, xts_sector_ni_rounds, ks1, ks2, sector, in, out, size, mode);
+}
+
+/**
+ * Carry-less multiply GHASH. Blocks are byte-reversed on load so the
+ * products come out in PCLMULQDQ's bit order; the 256-bit product is then
+ * shifted one bit to undo GHASH's bit reflection and reduced. Eight blocks
+ * are multiplied by H^8..H^1 and summed before a single reduction
+**/
+
+#define BSWAP_MASK _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+// adds the unreduced product a * b into lo, mid, hi
+TARGET_AESNI static void clmul_acc(__m128i a, __m128i b, __m128i *lo, __m128i *mid, __m128i *hi) {
+	*lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+	*hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+TARGET_AESNI static __m128i ghash_reduce(__m128i lo, __m128i mid, __m128i hi) {
+	__m128i t1, t2, t3;
+
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	// shift the 256-bit hi:lo left by one
+	t1 = _mm_srli_epi32(lo, 31);
+	t2 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t3 = _mm_srli_si128(t1, 12);
+	t2 = _mm_slli_si128(t2, 4);
+	t1 = _mm_slli_si128(t1, 4);
+	lo = _mm_or_si128(lo, t1);
+	hi = _mm_or_si128(hi, t2);
+	hi = _mm_or_si128(hi, t3);
+
+	// reduce modulo x^128 + x^7 + x^2 + x + 1
+	t1 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+	t2 = _mm_srli_si128(t1, 4);
+	lo = _mm_xor_si128(lo, _mm_slli_si128(t1, 12));
+	t3 = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+	t3 = _mm_xor_si128(t3, t2);
+	lo = _mm_xor_si128(lo, t3);
+	return _mm_xor_si128(hi, lo);
+}
+
+TARGET_AESNI static __m128i gf_mult_ni(__m128i a, __m128i b) {
+	__m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+	clmul_acc(a, b, &lo, &mid, &hi);
+	return ghash_reduce(lo, mid, hi);
+}
+
+TARGET_AESNI static void ghash_init_ni(ghash_key *gk, const unsigned char *h) {
+	__m128i h1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), BSWAP_MASK);
+	__m128i p = h1;
+
+	for (int i = 0; i < GHASH_POWERS; i++) {
+		_mm_storeu_si128((__m128i *)gk->powers[i], p);
+		p = gf_mult_ni(p, h1);
+	}
+}
+
+TARGET_AESNI static void ghash_ni(const ghash_key *gk, unsigned char *x, const unsigned char *in, size_t blocks) {
+	__m128i acc = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)x), BSWAP_MASK);
+	__m128i h[GHASH_POWERS];
+
+	for (int i = 0; i < GHASH_POWERS; i++) {
+		h[i] = _mm_loadu_si128((const __m128i *)gk->powers[i]);
+	}
+
+	for (; blocks >= GHASH_POWERS; blocks -= GHASH_POWERS, in += GHASH_POWERS * STATE_SIZE) {
+		__m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+		for (int i = 0; i < GHASH_POWERS; i++) {
+			__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i * STATE_SIZE)), BSWAP_MASK);
+			if (i == 0) {
+				b = _mm_xor_si128(b, acc);
+			}
+			clmul_acc(b, h[GHASH_POWERS - 1 - i], &lo, &mid, &hi);
+		}
+		acc = ghash_reduce(lo, mid, hi);
+	}
+	for (; blocks > 0; blocks--, in += STATE_SIZE) {
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), BSWAP_MASK);
+		acc = gf_mult_ni(_mm_xor_si128(acc, b), h[0]);
+	}
+
+	_mm_storeu_si128((__m128i *)x, _mm_shuffle_epi8(acc, BSWAP_MASK));
+}
+
+static void cpuid(unsigned int leaf, unsigned int *regs) {
+#if defined(_MSC_VER)
+	__cpuidex((int *)regs, (int)leaf, 0);
+#else
+	regs[0] = regs[1] = regs[2] = regs[3] = 0;
+	__get_cpuid_count(leaf, 0, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+}
+
+static int aesni_supported(void) {
+	unsigned int regs[4];
+	cpuid(1, regs);
+	// ecx bit 25 is AES, bit 9 is SSSE3 for the transposing shuffles, bit 1 is PCLMULQDQ for GHASH
+	return (regs[2] & (1u << 25)) && (regs[2] & (1u << 9)) && (regs[2] & (1u << 1));
+}
+
+/**
+ * The bitsliced rounds again on SSE2 and AVX2 registers, two and four
+ * 64-bit lanes wide, so 8 and 16 blocks per pass
+**/
+
+#if defined(_MSC_VER)
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define BS_WORD         __m128i
+#define BS_NAME(x)      x##_sse2
+#define BS_TARGET       TARGET_SSE2
+#define BS_XOR(a, b)    _mm_xor_si128(a, b)
+#define BS_AND(a, b)    _mm_and_si128(a, b)
+#define BS_NOT(a)       _mm_xor_si128(a, _mm_set1_epi32(-1))
+#define BS_SHL(a, n)    _mm_slli_epi64(a, n)
+#define BS_SHR(a, n)    _mm_srli_epi64(a, n)
+#define BS_ROTR32(a)    _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1))
+#define BS_SET1(x)      _mm_set1_epi64x((long long)(x))
+#include "bitslice.h"
+#undef BS_WORD
+#undef BS_NAME
+#undef BS_TARGET
+#undef BS_XOR
+#undef BS_AND
+#undef BS_NOT
+#undef BS_SHL
+#undef BS_SHR
+#undef BS_ROTR32
+#undef BS_SET1
+
+#define BS_WORD         __m256i
+#define BS_NAME(x)      x##_avx2
+#define BS_TARGET       TARGET_AVX2
+#define BS_XOR(a, b)    _mm256_xor_si256(a, b)
+#define BS_AND(a, b)    _mm256_and_si256(a, b)
+#define BS_NOT(a)       _mm256_xor_si256(a, _mm256_set1_epi32(-1))
+#define BS_SHL(a, n)    _mm256_slli_epi64(a, n)
+#define BS_SHR(a, n)    _mm256_srli_epi64(a, n)
+#define BS_ROTR32(a)    _mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1))
+#define BS_SET1(x)      _mm256_set1_epi64x((long long)(x))
+#include "bitslice.h"
+#undef BS_WORD
+#undef BS_NAME
+#undef BS_TARGET
+#undef BS_XOR
+#undef BS_AND
+#undef BS_NOT
+#undef BS_SHL
+#undef BS_SHR
+#undef BS_ROTR32
+#undef BS_SET1
+
+static int sse2_supported(void) {
+	unsigned int regs[4];
+	cpuid(1, regs);
+	return (regs[3] & (1u << 26)) != 0; // edx bit 26
+}
+
+static int avx2_supported(void) {
+	unsigned int regs[4];
+	uint64_t xcr0;
+
+	cpuid(1, regs);
+	// AVX, plus OSXSAVE so the OS can be asked whether it saves ymm state
+	if (!(regs[2] & (1u << 28)) || !(regs[2] & (1u << 27))) {
+		return 0;
+	}
+#if defined(_MSC_VER)
+	xcr0 = _xgetbv(0);
+#else
+	{
+		unsigned int lo, hi;
+		__asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((uint64_t)hi << 32) | lo;
+	}
+#endif
+	if ((xcr0 & 6) != 6) {
+		return 0;
+	}
+	cpuid(7, regs);
+	return (regs[1] & (1u << 5)) != 0; // ebx bit 5
+}
+
+#endif
+
+const cipher_backend backends[] = {
+	{ "reference", NULL, expand_key, invert_key, encrypt_block_cipher, decrypt_block_cipher,
+		encrypt_blocks_reference, decrypt_blocks_reference, generic_modes, ghash_init_table, ghash_table, xts_sector },
+	{ "table", NULL, expand_key, invert_key, encrypt_block_table, decrypt_block_table,
+		encrypt_blocks_table, decrypt_blocks_table, generic_modes, ghash_init_table, ghash_table, xts_sector },
+	{ "bitslice", NULL, expand_key_bs, invert_key, encrypt_block_bs, decrypt_block_bs,
+		encrypt_blocks_bs64, decrypt_blocks_bs64, generic_modes, ghash_init_table, ghash_ct, xts_sector },
+#ifdef HAVE_AESNI
+	{ "bitslice-sse2", sse2_supported, expand_key_bs, invert_key, encrypt_block_bs, decrypt_block_bs,
+		encrypt_blocks_sse2, decrypt_blocks_sse2, generic_modes, ghash_init_table, ghash_ct, xts_sector },
+	{ "bitslice-avx2", avx2_supported, expand_key_bs, invert_key, encrypt_block_bs, decrypt_block_bs,
+		encrypt_blocks_avx2, decrypt_blocks_avx2, generic_modes, ghash_init_table, ghash_ct, xts_sector },
+	{ "aesni", aesni_supported, expand_key_ni, invert_key_ni, encrypt_block_ni, decrypt_block_ni,
+		encrypt_blocks_ni, decrypt_blocks_ni, aesni_modes, ghash_init_ni, ghash_ni, xts_sector_ni },
+#endif
+};
+
+const size_t num_backends = sizeof(backends) / sizeof(backends[0]);
+
+// set once by init_core(), read-only afterwards
+static const cipher_backend *fastest_backend = &backends[1];
+
+int backend_supported(const cipher_backend *be) {
+	return be->supported == NULL || be->supported();
+}
+
+// picks the last (fastest) backend the CPU supports
+static void select_default_backend(void) {
+	for (size_t i = 0; i < num_backends; i++) {
+		if (backend_supported(&backends[i])) {
+			fastest_backend = &backends[i];
+		}
+	}
+}
+
+// the backend callers start on unless told otherwise; needs init_core()
+const cipher_backend* default_backend(void) {
+	return fastest_backend;
+}
+
+/**
+ * init_tables, init_pool and select_default_backend exactly once per
+ * process, however many interpreters import the module and however many
+ * threads race to do it
+**/
+static void init_core_once(void) {
+	init_tables();
+	init_pool();
+	select_default_backend();
+}
+
+#ifdef _WIN32
+static INIT_ONCE core_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK init_core_callback(PINIT_ONCE once, PVOID arg, PVOID *ctx) {
+	init_core_once();
+	return TRUE;
+}
+
+void init_core(void) {
+	InitOnceExecuteOnce(&core_once, init_core_callback, NULL, NULL);
+}
+#else
+static pthread_once_t core_once = PTHREAD_ONCE_INIT;
+
+void init_core(void) {
+	pthread_once(&core_once, init_core_once);
+}
+#endif
+
+/**
+ * GCM (NIST SP 800-38D): CTR with a 32-bit big-endian block counter,
+ * authenticated by GHASH over the AAD and the ciphertext. The key is in
+ * the module's byte order like every other key, but iv, data and tag are
+ * the standard byte strings. The counter block is kept transposed, in the
+ * order the cipher takes it, and keystream blocks are transposed back
+ * before the XOR. Keystream, XOR and hash run together a batch of blocks
+ * at a time, so the data is touched once while it is still in cache. in
+ * and out may be the same buffer
+**/
+#define GCM_BATCH    MODE_BATCH // blocks of keystream made and hashed per pass
+
+// the low 32 bits of a transposed counter block, least significant byte first
+static const unsigned char gcm_counter_bytes[4] = { 15, 11, 7, 3 };
+
+static void gcm_inc32(unsigned char *counter) {
+	for (int i = 0; i < 4; i++) {
+		if (++counter[gcm_counter_bytes[i]] != 0) {
+			break;
+		}
+	}
+}
+
+// hashes len bytes, zero-padding the last partial block
+static void gcm_hash(const cipher_backend *be, const ghash_key *gk, unsigned char *x, const unsigned char *in, size_t len) {
+	size_t blocks = len / STATE_SIZE;
+	size_t tail = len % STATE_SIZE;
+
+	be->ghash(gk, x, in, blocks);
+	if (tail > 0) {
+		unsigned char last[STATE_SIZE] = { 0 };
+		memcpy(last, in + blocks * STATE_SIZE, tail);
+		be->ghash(gk, x, last, 1);
+	}
+}
+
+void gcm_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *aad, size_t aad_len, const unsigned char *in, unsigned char *out, size_t len,
+		unsigned char *tag, int mode) {
+	unsigned char h[STATE_SIZE] = { 0 };
+	unsigned char j0[STATE_SIZE];
+	unsigned char counters[GCM_BATCH * STATE_SIZE];
+	unsigned char stream[GCM_BATCH * STATE_SIZE];
+	unsigned char x[STATE_SIZE] = { 0 };
+	unsigned char lengths[STATE_SIZE];
+	ghash_key gk;
+
+	be->encrypt(ks, h, h);
+	transpose_state(h, h);
+	be->ghash_init(&gk, h);
+
+	memcpy(j0, iv, GCM_IV_SIZE);
+	memset(j0 + GCM_IV_SIZE, 0, STATE_SIZE - GCM_IV_SIZE);
+	j0[STATE_SIZE - 1] = 1;
+	transpose_state(j0, j0);
+
+	gcm_hash(be, &gk, x, aad, aad_len);
+
+	unsigned char counter[STATE_SIZE];
+	uint64_t data_bits = (uint64_t)len * 8;
+	memcpy(counter, j0, STATE_SIZE);
+	while (len > 0) {
+		size_t n = len < sizeof(stream) ? len : sizeof(stream);
+		size_t blocks = (n + STATE_SIZE - 1) / STATE_SIZE;
+
+		for (size_t b = 0; b < blocks; b++) {
+			gcm_inc32(counter);
+			memcpy(counters + b * STATE_SIZE, counter, STATE_SIZE);
+		}
+		be->encrypt_blocks(ks, counters, stream, blocks);
+		for (size_t b = 0; b < blocks; b++) {
+			transpose_state(stream + b * STATE_SIZE, stream + b * STATE_SIZE);
+		}
+
+		// the hash always covers the ciphertext side
+		if (mode == DECRYPT) {
+			gcm_hash(be, &gk, x, in, n);
+		}
+		for (size_t i = 0; i < n; i++) {
+			out[i] = in[i] ^ stream[i];
+		}
+		if (mode == ENCRYPT) {
+			gcm_hash(be, &gk, x, out, n);
+		}
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	store_be64(lengths, (uint64_t)aad_len * 8);
+	store_be64(lengths + 8, data_bits);
+	be->ghash(&gk, x, lengths, 1);
+
+	be->encrypt(ks, j0, tag);
+	transpose_state(tag, tag);
+	xor_block(tag, x, tag);
+}
+
+static void stats_count_inversion(const cipher_backend *be);
+
+// builds the decryption schedule the first time a key is used to decrypt
+void prepare_decrypt(const cipher_backend *be, key_schedule *ks) {
+	if (!ks->dk_ready) {
+		be->invert(ks);
+		ks->dk_ready = 1;
+		if (load_stats_enabled()) {
+			stats_count_inversion(be);
+		}
+	}
+}
+
+/**
+ * Worker pool for splitting large inputs into chunks. Callers queue a job
+ * of independent tasks, run tasks from it themselves alongside the
+ * workers, and return once every task has finished. Workers never touch
+ * Python objects, so jobs run with the GIL released
+**/
+
+typedef struct pool_job {
+	void (*run)(void *ctx, size_t task);
+	void *ctx;
+	size_t tasks;
+	size_t next_task; // next task to hand out
+	size_t done;      // tasks finished
+	struct pool_job *next;
+} pool_job;
+
+static struct {
+	pool_mutex lock;
+	pool_cond work_ready;
+	pool_cond job_done;
+	pool_job *head;
+	pool_job *tail;
+	int workers; // threads started so far, the caller makes one more
+} pool;
+
+// process-wide settings, accessed through setting_load() and setting_store()
+static long pool_threads = 1;                // threads a job is split across
+static long parallel_threshold = 1 << 20;    // bytes below which calls stay serial, capped at LONG_MAX
+
+int load_pool_threads(void) {
+	return (int)setting_load(pool_threads);
+}
+
+void store_pool_threads(int threads) {
+	setting_store(pool_threads, threads < MAX_THREADS ? threads : MAX_THREADS);
+}
+
+size_t load_parallel_threshold(void) {
+	return (size_t)setting_load(parallel_threshold);
+}
+
+void store_parallel_threshold(size_t threshold) {
+	setting_store(parallel_threshold, threshold < LONG_MAX ? (long)threshold : LONG_MAX);
+}
+
+int cpu_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#endif
+}
+
+// hands out the next task of job, unqueuing it once all are handed out.
+// Call with the lock held
+static size_t claim_task(pool_job *job) {
+	size_t task = job->next_task++;
+
+	if (job->next_task == job->tasks) {
+		pool_job *prev = NULL;
+		pool_job *cur = pool.head;
+		while (cur != job) {
+			prev = cur;
+			cur = cur->next;
+		}
+		if (prev != NULL) {
+			prev->next = job->next;
+		} else {
+			pool.head = job->next;
+		}
+		if (pool.tail == job) {
+			pool.tail = prev;
+		}
+	}
+	return task;
+}
+
+static void finish_task(pool_job *job) {
+	mutex_lock(&pool.lock);
+	if (++job->done == job->tasks) {
+		cond_broadcast(&pool.job_done);
+	}
+	mutex_unlock(&pool.lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_worker(LPVOID unused) {
+#else
+static void* pool_worker(void *unused) {
+#endif
+	for (;;) {
+		size_t task;
+
+		mutex_lock(&pool.lock);
+		while (pool.head == NULL) {
+			cond_wait(&pool.work_ready, &pool.lock);
+		}
+		pool_job *job = pool.head;
+		task = claim_task(job);
+		mutex_unlock(&pool.lock);
+
+		job->run(job->ctx, task);
+		finish_task(job);
+	}
+	return 0;
+}
+
+void init_pool(void) {
+	mutex_init(&pool.lock);
+	cond_init(&pool.work_ready);
+	cond_init(&pool.job_done);
+	store_pool_threads(cpu_count());
+}
+
+// starts workers until `threads` can run at once, call with the lock held
+static void grow_pool(int threads) {
+	while (pool.workers < threads - 1) {
+#ifdef _WIN32
+		HANDLE t = CreateThread(NULL, 0, pool_worker, NULL, 0, NULL);
+		if (t == NULL) {
+			return;
+		}
+		CloseHandle(t);
+#else
+		pthread_t t;
+		if (pthread_create(&t, NULL, pool_worker, NULL) != 0) {
+			return;
+		}
+		pthread_detach(t);
+#endif
+		pool.workers++;
+	}
+}
+
+/**
+ * Runs run(ctx, 0..tasks-1) across the pool and returns when all are done.
+ * Falls back to running everything on the calling thread if no worker
+ * could be started
+**/
+static void pool_run(void (*run)(void *ctx, size_t task), void *ctx, size_t tasks) {
+	pool_job job = { run, ctx, tasks, 0, 0, NULL };
+	size_t task;
+
+	if (tasks == 0) {
+		return;
+	}
+
+	mutex_lock(&pool.lock);
+	grow_pool(load_pool_threads());
+	if (pool.tail != NULL) {
+		pool.tail->next = &job;
+	} else {
+		pool.head = &job;
+	}
+	pool.tail = &job;
+	cond_broadcast(&pool.work_ready);
+
+	// work on our own job until it is all handed out
+	while (job.next_task < job.tasks) {
+		task = claim_task(&job);
+		mutex_unlock(&pool.lock);
+		run(ctx, task);
+		mutex_lock(&pool.lock);
+		job.done++;
+	}
+
+	while (job.done < job.tasks) {
+		cond_wait(&pool.job_done, &pool.lock);
+	}
+	mutex_unlock(&pool.lock);
+}
+
+/**
+ * A mode call split into contiguous chunks of blocks, each chunk running
+ * the ordinary mode loop from its own starting iv
+**/
+typedef struct {
+	const cipher_backend *be;
+	const key_schedule *ks;
+	mode_func crypt;
+	const unsigned char *in;
+	unsigned char *out;
+	size_t blocks;
+	size_t chunk_blocks;
+	int mode;
+	unsigned char ivs[MAX_THREADS][STATE_SIZE];
+} chunked_call;
+
+static void run_chunk(void *ctx, size_t task) {
+	chunked_call *call = ctx;
+	size_t first = task * call->chunk_blocks;
+	size_t n = call->blocks - first < call->chunk_blocks ? call->blocks - first : call->chunk_blocks;
+
+	call->crypt(call->be, call->ks, call->ivs[task], call->in + first * STATE_SIZE,
+		call->out + first * STATE_SIZE, n, call->mode);
+}
+
+// adds n to a big-endian 128-bit counter block
+void add_counter(unsigned char *counter, uint64_t n) {
+	for (int i = STATE_SIZE - 1; i >= 0 && n != 0; i--) {
+		n += counter[i];
+		counter[i] = (unsigned char)n;
+		n >>= 8;
+	}
+}
+
+// true when a chunk can start mid-stream: its iv is derivable without running the blocks before it
+int mode_splits(int mode_id, int mode) {
+	return mode_id == MODE_ECB || mode_id == MODE_CTR
+		|| (mode == DECRYPT && (mode_id == MODE_CBC || mode_id == MODE_CFB));
+}
+
+/**
+ * Runs a mode over in, split across the pool when it is large enough and
+ * the mode allows it, otherwise on the calling thread. The output is the
+ * same either way
+**/
+void crypt_mode(const cipher_backend *be, const key_schedule *ks, int mode_id, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode) {
+	mode_func crypt = be->modes[mode_id];
+	int threads = load_pool_threads();
+
+	if (threads <= 1 || blocks < 2 || blocks * STATE_SIZE < load_parallel_threshold() || !mode_splits(mode_id, mode)) {
+		crypt(be, ks, iv, in, out, blocks, mode);
+		return;
+	}
+
+	chunked_call *call = malloc(sizeof(chunked_call));
+	if (call == NULL) {
+		crypt(be, ks, iv, in, out, blocks, mode);
+		return;
+	}
+
+	call->be = be;
+	call->ks = ks;
+	call->crypt = crypt;
+	call->in = in;
+	call->out = out;
+	call->blocks = blocks;
+	call->chunk_blocks = (blocks + threads - 1) / threads;
+	call->mode = mode;
+
+	size_t tasks = (blocks + call->chunk_blocks - 1) / call->chunk_blocks;
+	for (size_t t = 0; t < tasks; t++) {
+		size_t first = t * call->chunk_blocks;
+		if (mode_id == MODE_CTR) {
+			memcpy(call->ivs[t], iv, STATE_SIZE);
+			add_counter(call->ivs[t], first);
+		} else if (first == 0 || mode_id == MODE_ECB) {
+			if (iv != NULL) {
+				memcpy(call->ivs[t], iv, STATE_SIZE);
+			}
+		} else {
+			// copied up front since in place, the previous chunk overwrites it
+			memcpy(call->ivs[t], in + (first - 1) * STATE_SIZE, STATE_SIZE);
+		}
+	}
+
+	pool_run(run_chunk, call, tasks);
+	free(call);
+}
+
+/**
+ * Moves a chaining value past `blocks` blocks that ended with last_in and
+ * last_out, so a stream can resume exactly where the previous call stopped
+**/
+void advance_chain(int mode_id, int mode, unsigned char *chain,
+		const unsigned char *last_in, const unsigned char *last_out, size_t blocks) {
+	switch (mode_id) {
+	case MODE_CBC:
+	case MODE_CFB:
+		// the last ciphertext block
+		memcpy(chain, mode == ENCRYPT ? last_out : last_in, STATE_SIZE);
+		break;
+	case MODE_PCBC:
+	case MODE_OFB:
+		// plaintext ^ ciphertext, which for OFB is the last keystream block
+		xor_block(last_in, last_out, chain);
+		break;
+	case MODE_CTR:
+		add_counter(chain, blocks);
+		break;
+	}
+}
+
+/**
+ * Finishes a CFB, OFB or CTR stream whose last block is short: the
+ * leftover bytes are XORed with the front of the next keystream block
+**/
+void crypt_tail(const cipher_backend *be, const key_schedule *ks, const unsigned char *chain,
+		const unsigned char *in, unsigned char *out, size_t len) {
+	unsigned char stream[STATE_SIZE];
+
+	be->encrypt(ks, chain, stream);
+	for (size_t i = 0; i < len; i++) {
+		out[i] = in[i] ^ stream[i];
+	}
+}
+
+// modes whose final block may be short, the rest need whole blocks
+int mode_streams(int mode_id) {
+	return mode_id == MODE_CFB || mode_id == MODE_OFB || mode_id == MODE_CTR;
+}
+
+/**
+ * Memory-mapped files for encrypt_file/decrypt_file. The mode loops run
+ * straight over the mappings, so file data never passes through Python.
+ * A readable mapping takes its size from the file; a writable one creates
+ * or resizes the file to size first. Empty files are not mapped (data is
+ * NULL). On failure errno, or GetLastError() on Windows, says why
+**/
+
+#ifdef _WIN32
+int map_file(const char *path, int writable, size_t size, mapped_file *mf) {
+	LARGE_INTEGER len;
+
+	mf->data = NULL;
+	mf->mapping = NULL;
+	mf->file = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, writable ? OPEN_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mf->file == INVALID_HANDLE_VALUE) {
+		return -1;
+	}
+	if (!GetFileSizeEx(mf->file, &len)) {
+		goto fail;
+	}
+	if (!writable) {
+		size = (size_t)len.QuadPart;
+	} else if ((size_t)len.QuadPart != size) {
+		// a file with a live view can't be resized, so only touch it when needed
+		len.QuadPart = (LONGLONG)size;
+		if (!SetFilePointerEx(mf->file, len, NULL, FILE_BEGIN) || !SetEndOfFile(mf->file)) {
+			goto fail;
+		}
+	}
+	mf->size = size;
+	if (size == 0) {
+		return 0;
+	}
+
+	mf->mapping = CreateFileMappingA(mf->file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	if (mf->mapping == NULL) {
+		goto fail;
+	}
+	mf->data = MapViewOfFile(mf->mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+	if (mf->data == NULL) {
+		goto fail;
+	}
+	return 0;
+
+fail:
+	{
+		DWORD err = GetLastError();
+		if (mf->mapping != NULL) {
+			CloseHandle(mf->mapping);
+		}
+		CloseHandle(mf->file);
+		SetLastError(err);
+	}
+	return -1;
+}
+
+void unmap_file(mapped_file *mf) {
+	if (mf->data != NULL) {
+		UnmapViewOfFile(mf->data);
+	}
+	if (mf->mapping != NULL) {
+		CloseHandle(mf->mapping);
+	}
+	CloseHandle(mf->file);
+}
+#else
+int map_file(const char *path, int writable, size_t size, mapped_file *mf) {
+	struct stat st;
+
+	mf->data = NULL;
+	mf->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+	if (mf->fd < 0) {
+		return -1;
+	}
+	if (writable) {
+		if (ftruncate(mf->fd, (off_t)size) < 0) {
+			goto fail;
+		}
+	} else {
+		if (fstat(mf->fd, &st) < 0) {
+			goto fail;
+		}
+		size = (size_t)st.st_size;
+	}
+	mf->size = size;
+	if (size == 0) {
+		return 0;
+	}
+
+	void *p = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, mf->fd, 0);
+	if (p == MAP_FAILED) {
+		goto fail;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(p, size, MADV_SEQUENTIAL);
+#endif
+	mf->data = p;
+	return 0;
+
+fail:
+	{
+		int err = errno;
+		close(mf->fd);
+		errno = err;
+	}
+	return -1;
+}
+
+void unmap_file(mapped_file *mf) {
+	if (mf->data != NULL) {
+		munmap(mf->data, mf->size);
+	}
+	close(mf->fd);
+}
+#endif
+
+/**
+ * Runs a whole mode over len bytes, finishing a short last block for the
+ * modes that allow one. in and out may be the same mapping
+**/
+void crypt_whole(const cipher_backend *be, const key_schedule *ks, int mode_id,
+		const unsigned char *iv, const unsigned char *in, unsigned char *out, size_t len, int mode) {
+	size_t blocks = len / STATE_SIZE;
+	size_t tail = len % STATE_SIZE;
+	unsigned char chain[STATE_SIZE];
+	unsigned char last_in[STATE_SIZE];
+
+	if (tail > 0) {
+		// saved up front, the output may overwrite it
+		memcpy(chain, iv, STATE_SIZE);
+		if (blocks > 0) {
+			memcpy(last_in, in + (blocks - 1) * STATE_SIZE, STATE_SIZE);
+		}
+	}
+
+	crypt_mode(be, ks, mode_id, iv, in, out, blocks, mode);
+
+	if (tail > 0) {
+		if (blocks > 0) {
+			advance_chain(mode_id, mode, chain, last_in, out + (blocks - 1) * STATE_SIZE, blocks);
+		}
+		crypt_tail(be, ks, chain, in + blocks * STATE_SIZE, out + blocks * STATE_SIZE, tail);
+	}
+}
+
+/**
+ * Many independent messages under one key. Each message holds a lane
+ * of up to MODE_BATCH; every step takes one block from each lane and runs
+ * them through a single encrypt_blocks/decrypt_blocks call, so even CBC
+ * encryption, serial within a message, fills the wide engines across
+ * messages. A finished message hands its lane to the next one. Message i
+ * is in[offsets[i]..offsets[i + 1]) with its iv at ivs + i * STATE_SIZE,
+ * and its output goes to the same place in out
+**/
+static void crypt_messages(const batch_call *call, size_t first, size_t last) {
+	const int mode_id = call->mode_id;
+	const int mode = call->mode;
+	const int inverse = mode == DECRYPT && modes[mode_id].uses_inverse;
+	size_t msg[MODE_BATCH];
+	size_t pos[MODE_BATCH];
+	unsigned char chain[MODE_BATCH * STATE_SIZE];
+	unsigned char x[MODE_BATCH * STATE_SIZE];
+	size_t next = first;
+	int lanes = 0;
+
+	for (;;) {
+		for (; lanes < MODE_BATCH && next < last; next++) {
+			if (call->offsets[next] == call->offsets[next + 1]) {
+				continue;
+			}
+			msg[lanes] = next;
+			pos[lanes] = call->offsets[next];
+			if (mode_id != MODE_ECB) {
+				memcpy(chain + lanes * STATE_SIZE, call->ivs + next * STATE_SIZE, STATE_SIZE);
+			}
+			lanes++;
+		}
+		if (lanes == 0) {
+			break;
+		}
+
+		// the block each lane feeds the cipher
+		for (int l = 0; l < lanes; l++) {
+			const unsigned char *p = call->in + pos[l];
+			unsigned char *xl = x + l * STATE_SIZE;
+			if (mode_id == MODE_ECB || (mode == DECRYPT && (mode_id == MODE_CBC || mode_id == MODE_PCBC))) {
+				memcpy(xl, p, STATE_SIZE);
+			} else if (mode_id == MODE_CBC || mode_id == MODE_PCBC) {
+				xor_block(p, chain + l * STATE_SIZE, xl);
+			} else {
+				memcpy(xl, chain + l * STATE_SIZE, STATE_SIZE);
+			}
+		}
+
+		if (inverse) {
+			call->be->decrypt_blocks(call->ks, x, x, lanes);
+		} else {
+			call->be->encrypt_blocks(call->ks, x, x, lanes);
+		}
+
+		for (int l = 0; l < lanes; l++) {
+			size_t end = call->offsets[msg[l] + 1];
+			size_t n = end - pos[l] < STATE_SIZE ? end - pos[l] : STATE_SIZE;
+			unsigned char *c = chain + l * STATE_SIZE;
+			unsigned char *xl = x + l * STATE_SIZE;
+			unsigned char block[STATE_SIZE];
+			unsigned char result[STATE_SIZE];
+
+			// read before out is written, they may overlap
+			memcpy(block, call->in + pos[l], n);
+			switch (mode_id) {
+			case MODE_ECB:
+				memcpy(result, xl, STATE_SIZE);
+				break;
+			case MODE_CBC:
+				if (mode == ENCRYPT) {
+					memcpy(result, xl, STATE_SIZE);
+					memcpy(c, xl, STATE_SIZE);
+				} else {
+					xor_block(xl, c, result);
+					memcpy(c, block, STATE_SIZE);
+				}
+				break;
+			case MODE_PCBC:
+				if (mode == ENCRYPT) {
+					memcpy(result, xl, STATE_SIZE);
+				} else {
+					xor_block(xl, c, result);
+				}
+				xor_block(block, result, c);
+				break;
+			case MODE_CFB:
+				for (size_t i = 0; i < n; i++) {
+					result[i] = block[i] ^ xl[i];
+				}
+				memcpy(c, mode == ENCRYPT ? result : block, n);
+				break;
+			case MODE_OFB:
+			case MODE_CTR:
+				for (size_t i = 0; i < n; i++) {
+					result[i] = block[i] ^ xl[i];
+				}
+				if (mode_id == MODE_OFB) {
+					memcpy(c, xl, STATE_SIZE);
+				} else {
+					increment_counter(c);
+				}
+				break;
+			}
+			memcpy(call->out + pos[l], result, n);
+			pos[l] += n;
+		}
+
+		// finished messages give up their lane to the last one
+		for (int l = 0; l < lanes; l++) {
+			if (pos[l] == call->offsets[msg[l] + 1]) {
+				lanes--;
+				msg[l] = msg[lanes];
+				pos[l] = pos[lanes];
+				memcpy(chain + l * STATE_SIZE, chain + lanes * STATE_SIZE, STATE_SIZE);
+				l--;
+			}
+		}
+	}
+}
+
+static void run_messages(void *ctx, size_t task) {
+	batch_call *call = ctx;
+	size_t first = task * call->chunk;
+	size_t last = call->count - first < call->chunk ? call->count : first + call->chunk;
+
+	crypt_messages(call, first, last);
+}
+
+// splits the messages across the pool when there is enough data, the output is the same either way
+void crypt_batch(batch_call *call) {
+	int threads = load_pool_threads();
+	size_t total = call->offsets[call->count];
+
+	if (threads <= 1 || call->count < 2 || total < load_parallel_threshold()) {
+		crypt_messages(call, 0, call->count);
+		return;
+	}
+	call->chunk = (call->count + threads - 1) / threads;
+	pool_run(run_messages, call, (call->count + call->chunk - 1) / call->chunk);
+}
+
+/**
+ * XTS calls split across the pool by sector, each sector running the
+ * backend's xts routine
+**/
+static void xts_sectors(const xts_call *call, size_t first, size_t last) {
+	for (size_t s = first; s < last; s++) {
+		size_t at = s * call->sector_size;
+		call->be->xts(call->be, call->ks1, call->ks2, call->first_sector + s,
+			call->in + at, call->out + at, call->sector_size, call->mode);
+	}
+}
+
+static void run_xts(void *ctx, size_t task) {
+	xts_call *call = ctx;
+	size_t first = task * call->chunk;
+	size_t last = call->sectors - first < call->chunk ? call->sectors : first + call->chunk;
+
+	xts_sectors(call, first, last);
+}
+
+void xts_crypt(xts_call *call) {
+	int threads = load_pool_threads();
+
+	if (threads <= 1 || call->sectors < 2 || call->sectors * call->sector_size < load_parallel_threshold()) {
+		xts_sectors(call, 0, call->sectors);
+		return;
+	}
+	call->chunk = (call->sectors + threads - 1) / threads;
+	pool_run(run_xts, call, (call->sectors + call->chunk - 1) / call->chunk);
+}
+
+/**
+ * Keystream ahead of use for OFB and CTR, whose keystream does not depend
+ * on the data. A producer, the background thread or keystream_fill() at
+ * idle moments, tops the ring up a turn at a time; keystream_xor() takes
+ * from the ring and, once it is dry, makes the rest inline straight into
+ * the output. Only whoever set `generating` touches chain, and the ring
+ * bytes between consumed and produced belong to the reader
+**/
+#define KEYSTREAM_TURN 16384 // most bytes made per producer turn, bounding a reader's wait
+
+static const unsigned char zero_block[STATE_SIZE];
+
+// out[i] = a[i] ^ b[i] for any len
+static void xor_bytes(const unsigned char *a, const unsigned char *b, unsigned char *out, size_t len) {
+	size_t words = len & ~(size_t)7;
+
+	xor_words(a, b, out, words);
+	for (size_t i = words; i < len; i++) {
+		out[i] = a[i] ^ b[i];
+	}
+}
+
+// makes up to max bytes of keystream into the ring. Call with the lock
+// held; returns 0 if there was no room or someone else is generating
+static int keystream_turn(keystream *kst, size_t max) {
+	size_t pos = (size_t)(kst->produced % kst->capacity);
+	size_t n = kst->capacity - (size_t)(kst->produced - kst->consumed);
+
+	if (kst->generating) {
+		return 0;
+	}
+	if (n > kst->capacity - pos) {
+		n = kst->capacity - pos;
+	}
+	if (n > max) {
+		n = max;
+	}
+	n -= n % STATE_SIZE;
+	if (n == 0) {
+		return 0;
+	}
+
+	size_t blocks = n / STATE_SIZE;
+	unsigned char *out = kst->ring + pos;
+	kst->generating = 1;
+	mutex_unlock(&kst->lock);
+	memset(out, 0, n);
+	kst->be->modes[kst->mode_id](kst->be, &kst->ks, kst->chain, out, out, blocks, ENCRYPT);
+	advance_chain(kst->mode_id, ENCRYPT, kst->chain, zero_block, out + n - STATE_SIZE, blocks);
+	mutex_lock(&kst->lock);
+	kst->produced += n;
+	kst->generating = 0;
+	cond_broadcast(&kst->changed);
+	return 1;
+}
+
+static void keystream_producer(keystream *kst) {
+	mutex_lock(&kst->lock);
+	while (!kst->stop) {
+		if (!keystream_turn(kst, KEYSTREAM_TURN)) {
+			cond_wait(&kst->changed, &kst->lock);
+		}
+	}
+	mutex_unlock(&kst->lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI keystream_thread(LPVOID arg) {
+	keystream_producer(arg);
+	return 0;
+}
+#else
+static void* keystream_thread(void *arg) {
+	keystream_producer(arg);
+	return NULL;
+}
+#endif
+
+/**
+ * Sets up kst to make keystream for mode_id from iv (the counter block for
+ * CTR), keeping up to lookahead bytes ready. With background set a thread
+ * keeps the ring full, otherwise only keystream_fill() does. Returns -1 if
+ * the ring or thread cannot be had
+**/
+int keystream_init(keystream *kst, const cipher_backend *be, const key_schedule *ks, int mode_id,
+		const unsigned char *iv, size_t lookahead, int background) {
+	kst->be = be;
+	kst->ks = *ks;
+	kst->mode_id = mode_id;
+	memcpy(kst->chain, iv, STATE_SIZE);
+	kst->capacity = lookahead < STATE_SIZE ? STATE_SIZE : (lookahead + STATE_SIZE - 1) / STATE_SIZE * STATE_SIZE;
+	kst->produced = 0;
+	kst->consumed = 0;
+	kst->generating = 0;
+	kst->background = 0;
+	kst->stop = 0;
+
+	kst->ring = malloc(kst->capacity);
+	if (kst->ring == NULL) {
+		return -1;
+	}
+	mutex_init(&kst->lock);
+	cond_init(&kst->changed);
+
+	if (background) {
+#ifdef _WIN32
+		kst->thread = CreateThread(NULL, 0, keystream_thread, kst, 0, NULL);
+		kst->background = kst->thread != NULL;
+#else
+		kst->background = pthread_create(&kst->thread, NULL, keystream_thread, kst) == 0;
+#endif
+		if (!kst->background) {
+			keystream_free(kst);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// tops the ring up on the calling thread, for idle moments
+void keystream_fill(keystream *kst) {
+	mutex_lock(&kst->lock);
+	while (keystream_turn(kst, KEYSTREAM_TURN)) {
+	}
+	mutex_unlock(&kst->lock);
+}
+
+// out = in ^ the next len bytes of keystream; in and out may be the same buffer
+void keystream_xor(keystream *kst, const unsigned char *in, unsigned char *out, size_t len) {
+	mutex_lock(&kst->lock);
+	while (len > 0) {
+		size_t ready = (size_t)(kst->produced - kst->consumed);
+
+		if (ready > 0) {
+			size_t pos = (size_t)(kst->consumed % kst->capacity);
+			size_t n = ready < len ? ready : len;
+			if (n > kst->capacity - pos) {
+				n = kst->capacity - pos;
+			}
+			mutex_unlock(&kst->lock);
+			xor_bytes(in, kst->ring + pos, out, n);
+			mutex_lock(&kst->lock);
+			kst->consumed += n;
+			in += n;
+			out += n;
+			len -= n;
+			cond_broadcast(&kst->changed);
+		} else if (kst->generating) {
+			// a producer turn is under way, shorter than making it ourselves
+			cond_wait(&kst->changed, &kst->lock);
+		} else if (len >= STATE_SIZE) {
+			// dry: the whole blocks go straight through the mode
+			size_t blocks = len / STATE_SIZE;
+			size_t n = blocks * STATE_SIZE;
+			unsigned char last_in[STATE_SIZE];
+			kst->generating = 1;
+			mutex_unlock(&kst->lock);
+			memcpy(last_in, in + n - STATE_SIZE, STATE_SIZE);
+			crypt_mode(kst->be, &kst->ks, kst->mode_id, kst->chain, in, out, blocks, ENCRYPT);
+			advance_chain(kst->mode_id, ENCRYPT, kst->chain, last_in, out + n - STATE_SIZE, blocks);
+			mutex_lock(&kst->lock);
+			kst->produced += n;
+			kst->consumed += n;
+			kst->generating = 0;
+			cond_broadcast(&kst->changed);
+			in += n;
+			out += n;
+			len -= n;
+		} else {
+			// under a block left: make one into the empty ring
+			keystream_turn(kst, STATE_SIZE);
+		}
+	}
+	mutex_unlock(&kst->lock);
+}
+
+size_t keystream_buffered(keystream *kst) {
+	mutex_lock(&kst->lock);
+	size_t ready = (size_t)(kst->produced - kst->consumed);
+	mutex_unlock(&kst->lock);
+	return ready;
+}
+
+// stops the producer thread, if any, and frees the ring
+void keystream_free(keystream *kst) {
+	if (kst->background) {
+		mutex_lock(&kst->lock);
+		kst->stop = 1;
+		cond_broadcast(&kst->changed);
+		mutex_unlock(&kst->lock);
+#ifdef _WIN32
+		WaitForSingleObject(kst->thread, INFINITE);
+		CloseHandle(kst->thread);
+#else
+		pthread_join(kst->thread, NULL);
+#endif
+		kst->background = 0;
+	}
+	mutex_destroy(&kst->lock);
+	cond_destroy(&kst->changed);
+	free(kst->ring);
+	kst->ring = NULL;
+}
+
+/**
+ * Job queue workers take queued jobs up to JOB_BATCH bytes at a time, so a
+ * burst of small requests costs one wakeup and one lock round trip per
+ * batch rather than per job. Large jobs still split across the pool
+**/
+#define JOB_BATCH (256 * 1024)
+
+static void job_worker(job_queue *q) {
+	mutex_lock(&q->lock);
+	for (;;) {
+		while (q->queued == NULL && !q->stop) {
+			cond_wait(&q->work_ready, &q->lock);
+		}
+		if (q->queued == NULL) {
+			break;
+		}
+
+		crypt_job *first = q->queued;
+		crypt_job *last = first;
+		size_t bytes = first->len;
+		while (last->next != NULL && bytes + last->next->len <= JOB_BATCH) {
+			last = last->next;
+			bytes += last->len;
+		}
+		q->queued = last->next;
+		if (q->queued == NULL) {
+			q->queued_tail = NULL;
+		} else {
+			// more left over than this batch, another worker can start on it
+			cond_signal(&q->work_ready);
+		}
+		last->next = NULL;
+		mutex_unlock(&q->lock);
+
+		for (crypt_job *job = first; job != NULL; job = job->next) {
+			uint64_t start = stats_start();
+			crypt_whole(job->be, job->ks, job->mode_id, job->iv, job->in, job->out, job->len, job->mode);
+			stats_record(job->be, job->mode_id, job->mode, job->len, start);
+		}
+
+		mutex_lock(&q->lock);
+		int was_empty = q->done == NULL;
+		if (was_empty) {
+			q->done = first;
+		} else {
+			q->done_tail->next = first;
+		}
+		q->done_tail = last;
+		if (was_empty) {
+			mutex_unlock(&q->lock);
+			q->notify(q->notify_arg);
+			mutex_lock(&q->lock);
+		}
+	}
+	mutex_unlock(&q->lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI job_thread(LPVOID arg) {
+	job_worker(arg);
+	return 0;
+}
+#else
+static void* job_thread(void *arg) {
+	job_worker(arg);
+	return NULL;
+}
+#endif
+
+// starts `workers` threads; returns -1 if none could be started
+int job_queue_init(job_queue *q, int workers, void (*notify)(void *arg), void *notify_arg) {
+	q->queued = q->queued_tail = NULL;
+	q->done = q->done_tail = NULL;
+	q->notify = notify;
+	q->notify_arg = notify_arg;
+	q->workers = 0;
+	q->stop = 0;
+	mutex_init(&q->lock);
+	cond_init(&q->work_ready);
+
+	if (workers > MAX_THREADS) {
+		workers = MAX_THREADS;
+	}
+	while (q->workers < workers) {
+#ifdef _WIN32
+		q->threads[q->workers] = CreateThread(NULL, 0, job_thread, q, 0, NULL);
+		if (q->threads[q->workers] == NULL) {
+			break;
+		}
+#else
+		if (pthread_create(&q->threads[q->workers], NULL, job_thread, q) != 0) {
+			break;
+		}
+#endif
+		q->workers++;
+	}
+	if (q->workers == 0) {
+		job_queue_stop(q);
+		job_queue_free(q);
+		return -1;
+	}
+	return 0;
+}
+
+// returns -1, queuing nothing, once the queue has been stopped
+int job_queue_submit(job_queue *q, crypt_job *job) {
+	job->next = NULL;
+	mutex_lock(&q->lock);
+	if (q->stop) {
+		mutex_unlock(&q->lock);
+		return -1;
+	}
+	if (q->queued_tail != NULL) {
+		q->queued_tail->next = job;
+	} else {
+		q->queued = job;
+	}
+	q->queued_tail = job;
+	cond_signal(&q->work_ready);
+	mutex_unlock(&q->lock);
+	return 0;
+}
+
+// detaches every finished job, oldest batch first
+crypt_job* job_queue_take_done(job_queue *q) {
+	mutex_lock(&q->lock);
+	crypt_job *done = q->done;
+	q->done = q->done_tail = NULL;
+	mutex_unlock(&q->lock);
+	return done;
+}
+
+// runs whatever is still queued, then stops the workers. Later submits
+// fail; finished jobs stay for job_queue_take_done()
+void job_queue_stop(job_queue *q) {
+	mutex_lock(&q->lock);
+	q->stop = 1;
+	cond_broadcast(&q->work_ready);
+	mutex_unlock(&q->lock);
+
+	for (int i = 0; i < q->workers; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(q->threads[i], INFINITE);
+		CloseHandle(q->threads[i]);
+#else
+		pthread_join(q->threads[i], NULL);
+#endif
+	}
+	q->workers = 0;
+}
+
+// after job_queue_stop(), returns the finished jobs nobody took
+crypt_job* job_queue_free(job_queue *q) {
+	mutex_destroy(&q->lock);
+	cond_destroy(&q->work_ready);
+	return q->done;
+}
+
+// the counter block is the 64-bit nonce followed by a 64-bit block counter
+void nonce_counter_block(unsigned long long nonce, unsigned char *counter) {
+	for (int i = 0; i < 8; i++) {
+		counter[i] = (unsigned char)(nonce >> (56 - 8 * i));
+		counter[8 + i] = 0;
+	}
+}
+
+int find_mode(const char *name) {
+	for (int i = 0; i < (int)(sizeof(modes) / sizeof(modes[0])); i++) {
+		if (strcmp(modes[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const cipher_backend* find_backend(const char *name) {
+	for (size_t i = 0; i < num_backends; i++) {
+		if (strcmp(backends[i].name, name) == 0) {
+			return &backends[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Usage counters. Adds are relaxed atomics: nothing orders against them, a
+ * reader only wants each total to be whole. Tables are indexed by the
+ * backend's position in backends[]
+**/
+#if defined(_MSC_VER)
+#define stat_add(counter, n) _InterlockedExchangeAdd64((volatile __int64 *)&(counter), (__int64)(n))
+#define stat_load(counter)   ((uint64_t)_InterlockedOr64((volatile __int64 *)&(counter), 0))
+#define stat_zero(counter)   _InterlockedExchange64((volatile __int64 *)&(counter), 0)
+#else
+#define stat_add(counter, n) __atomic_fetch_add(&(counter), (uint64_t)(n), __ATOMIC_RELAXED)
+#define stat_load(counter)   __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define stat_zero(counter)   __atomic_store_n(&(counter), 0, __ATOMIC_RELAXED)
+#endif
+
+#define STAT_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static long stats_enabled = 0;
+
+int load_stats_enabled(void) {
+	return (int)setting_load(stats_enabled);
+}
+
+void store_stats_enabled(int enabled) {
+	setting_store(stats_enabled, enabled != 0);
+}
+
+static op_stats op_counts[STAT_BACKENDS][STAT_MODES][2];
+static uint64_t key_expansions[STAT_BACKENDS];
+static uint64_t key_inversions[STAT_BACKENDS];
+
+const char* stat_mode_name(int stat_mode) {
+	switch (stat_mode) {
+	case STAT_GCM:
+		return "gcm";
+	case STAT_XTS:
+		return "xts";
+	default:
+		return modes[stat_mode].name;
+	}
+}
+
+// monotonic nanoseconds
+static uint64_t stats_clock(void) {
+#ifdef _WIN32
+	LARGE_INTEGER now, freq;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// floor(log2(v)), clamped into a table of `buckets`; 0 and 1 share bucket 0
+static int stat_bucket(uint64_t v, int buckets) {
+	int b = 0;
+	while (v > 1 && b < buckets - 1) {
+		v >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static void stats_count_inversion(const cipher_backend *be) {
+	stat_add(key_inversions[be - backends], 1);
+}
+
+// expands a key and counts it, the one way callers build a key schedule
+void schedule_key(const cipher_backend *be, const unsigned char *key, int key_size, key_schedule *ks) {
+	be->expand(key, key_size, ks);
+	if (load_stats_enabled()) {
+		stat_add(key_expansions[be - backends], 1);
+	}
+}
+
+// the start time for stats_record, or 0 when counting is off
+uint64_t stats_start(void) {
+	return load_stats_enabled() ? stats_clock() : 0;
+}
+
+void stats_record(const cipher_backend *be, int stat_mode, int mode, size_t bytes, uint64_t start) {
+	if (start == 0 || !load_stats_enabled()) {
+		return;
+	}
+	op_stats *op = &op_counts[be - backends][stat_mode][mode];
+	uint64_t elapsed = stats_clock() - start;
+
+	stat_add(op->calls, 1);
+	stat_add(op->bytes, bytes);
+	stat_add(op->blocks, (bytes + STATE_SIZE - 1) / STATE_SIZE);
+	stat_add(op->sizes[stat_bucket(bytes, STAT_SIZE_BUCKETS)], 1);
+	stat_add(op->latency[stat_bucket(elapsed, STAT_TIME_BUCKETS)], 1);
+}
+
+void stats_read(size_t backend, int stat_mode, int mode, op_stats *out) {
+	op_stats *op = &op_counts[backend][stat_mode][mode];
+
+	out->calls = stat_load(op->calls);
+	out->bytes = stat_load(op->bytes);
+	out->blocks = stat_load(op->blocks);
+	for (int i = 0; i < STAT_SIZE_BUCKETS; i++) {
+		out->sizes[i] = stat_load(op->sizes[i]);
+	}
+	for (int i = 0; i < STAT_TIME_BUCKETS; i++) {
+		out->latency[i] = stat_load(op->latency[i]);
+	}
+}
+
+uint64_t stats_key_expansions(size_t backend) {
+	return stat_load(key_expansions[backend]);
+}
+
+uint64_t stats_key_inversions(size_t backend) {
+	return stat_load(key_inversions[backend]);
+}
+
+// calls running meanwhile may land on either side of the reset; op_stats
+// is nothing but counters, so the table is zeroed as one run of them
+void stats_reset(void) {
+	uint64_t *counters = (uint64_t *)op_counts;
+
+	for (size_t i = 0; i < sizeof(op_counts) / sizeof(uint64_t); i++) {
+		stat_zero(counters[i]);
+	}
+	for (size_t b = 0; b < STAT_BACKENDS; b++) {
+		stat_zero(key_expansions[b]);
+		stat_zero(key_inversions[b]);
+	}
+}
@@ -0,0 +1,337 @@
+#ifndef BLOCKCIPHER_CORE_H
+#define BLOCKCIPHER_CORE_H
+
+/**
+ * Interface to blockcipher_core.c, the cipher without any Python: used by
+ * the blockcipher module (blockcipher.c) and the bccrypt tool (bccrypt.c)
+**/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define STATE_SIZE   16 // state size in bytes
+#define MAX_KEY_SIZE 32 // key sizes are 16, 24 or 32 bytes
+#define ROUNDS_128   11 // round keys for a 16-byte (128-bit) key
+#define ROUNDS_192   13 // 24-byte key
+#define ROUNDS_256   15 // 32-byte key
+#define MAX_ROUNDS   ROUNDS_256
+#define ENCRYPT      0
+#define DECRYPT      1
+
+/**
+ * Expanded key material, built once per key and reused for every block
+**/
+typedef struct {
+	unsigned char round_keys[MAX_ROUNDS * STATE_SIZE]; // row-major bytes, reference cipher
+	uint32_t ek[MAX_ROUNDS * 4];                       // column words, table cipher
+	uint32_t dk[MAX_ROUNDS * 4];                       // equivalent inverse cipher words
+	uint64_t bk[MAX_ROUNDS * 8];                       // bit planes, bitsliced cipher
+	int key_size;                                      // 16, 24 or 32 bytes
+	int rounds;                                        // round keys in use, ROUNDS_128/192/256
+	int dk_ready;                                      // dk is built on first decrypt
+} key_schedule;
+
+#define GHASH_POWERS 8 // blocks folded per reduction by the carry-less engine
+
+typedef struct {
+	uint64_t hl[16], hh[16];                 // H times every 4-bit value, table engine
+	unsigned char powers[GHASH_POWERS][16];  // H^1..H^8 byte-reversed, carry-less engine
+} ghash_key;
+
+typedef struct cipher_backend cipher_backend;
+
+/**
+ * Chaining modes, each processing `blocks` whole blocks from in to out with
+ * the chaining value kept in a local block. in and out may be the same
+ * buffer, so every loop finishes reading a block before writing it. The iv
+ * argument is the initial counter block for ctr_crypt and unused by ecb
+**/
+typedef void (*mode_func)(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode);
+
+/**
+ * A block cipher implementation the chaining modes run on top of. All of
+ * them produce identical output and identical key material, so a Key built
+ * under one backend works under any other; "reference" is the byte-wise
+ * code kept for validating the faster engines against
+**/
+struct cipher_backend {
+	const char *name;
+	int (*supported)(void); // NULL when it runs everywhere
+	void (*expand)(const unsigned char *key, int key_size, key_schedule *ks);
+	void (*invert)(key_schedule *ks);
+	void (*encrypt)(const key_schedule *ks, const unsigned char *input, unsigned char *output);
+	void (*decrypt)(const key_schedule *ks, const unsigned char *input, unsigned char *output);
+	// independent blocks, interleaved as deep as the engine allows
+	void (*encrypt_blocks)(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks);
+	void (*decrypt_blocks)(const key_schedule *ks, const unsigned char *in, unsigned char *out, size_t blocks);
+	const mode_func *modes; // indexed by MODE_*
+	void (*ghash_init)(ghash_key *gk, const unsigned char *h);
+	// folds whole blocks into the running hash x
+	void (*ghash)(const ghash_key *gk, unsigned char *x, const unsigned char *in, size_t blocks);
+	// one XTS sector of size bytes, ks1 for the data and ks2 for the tweak
+	void (*xts)(const cipher_backend *be, const key_schedule *ks1, const key_schedule *ks2,
+		uint64_t sector, const unsigned char *in, unsigned char *out, size_t size, int mode);
+};
+
+/**
+ * Mode table, indexed by the MODE_* constants
+**/
+typedef struct {
+	const char *name;
+	int uses_inverse; // decryption runs the inverse cipher, so needs dk
+} cipher_mode;
+
+enum { MODE_ECB, MODE_CBC, MODE_PCBC, MODE_CFB, MODE_OFB, MODE_CTR };
+extern const cipher_mode modes[];
+extern const cipher_backend backends[];
+extern const size_t num_backends;
+
+#define GCM_IV_SIZE  12
+#define GCM_TAG_SIZE 16
+#define GCM_MAX_DATA ((((uint64_t)1 << 32) - 2) * STATE_SIZE) // 2^39 - 256 bits
+
+/**
+ * Worker pool. Large calls are split across the pool's threads once they
+ * reach the parallel threshold; the mutex and condition wrappers are
+ * shared with callers that run threads of their own
+**/
+#ifdef _WIN32
+typedef CRITICAL_SECTION pool_mutex;
+typedef CONDITION_VARIABLE pool_cond;
+#define mutex_init(m)     InitializeCriticalSection(m)
+#define mutex_destroy(m)  DeleteCriticalSection(m)
+#define mutex_lock(m)     EnterCriticalSection(m)
+#define mutex_unlock(m)   LeaveCriticalSection(m)
+#define cond_init(c)      InitializeConditionVariable(c)
+#define cond_destroy(c)   ((void)(c))
+#define cond_wait(c, m)   SleepConditionVariableCS(c, m, INFINITE)
+#define cond_signal(c)    WakeConditionVariable(c)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t pool_mutex;
+typedef pthread_cond_t pool_cond;
+#define mutex_init(m)     pthread_mutex_init(m, NULL)
+#define mutex_destroy(m)  pthread_mutex_destroy(m)
+#define mutex_lock(m)     pthread_mutex_lock(m)
+#define mutex_unlock(m)   pthread_mutex_unlock(m)
+#define cond_init(c)      pthread_cond_init(c, NULL)
+#define cond_destroy(c)   pthread_cond_destroy(c)
+#define cond_wait(c, m)   pthread_cond_wait(c, m)
+#define cond_signal(c)    pthread_cond_signal(c)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+#define MAX_THREADS 64
+
+/**
+ * Settings. Calls read them with the GIL released while set_threads(),
+ * set_backend() and friends may be writing, so every access is a relaxed
+ * atomic; nothing is published through them, a call only wants one whole
+ * value to work with. setting_* takes a long, setting_*_ptr a pointer
+**/
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define setting_load(v)          _InterlockedOr((volatile long *)&(v), 0)
+#define setting_store(v, x)      _InterlockedExchange((volatile long *)&(v), (long)(x))
+#define setting_load_ptr(v)      _InterlockedCompareExchangePointer((void * volatile *)&(v), NULL, NULL)
+#define setting_store_ptr(v, x)  _InterlockedExchangePointer((void * volatile *)&(v), (void *)(x))
+#else
+#define setting_load(v)          __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define setting_store(v, x)      __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+#define setting_load_ptr(v)      __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define setting_store_ptr(v, x)  __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+#endif
+
+int load_pool_threads(void);
+void store_pool_threads(int threads); // clamped to MAX_THREADS
+size_t load_parallel_threshold(void);
+void store_parallel_threshold(size_t threshold);
+
+typedef struct {
+	unsigned char *data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+} mapped_file;
+
+typedef struct {
+	const cipher_backend *be;
+	const key_schedule *ks;
+	int mode_id;
+	int mode;
+	const unsigned char *ivs;
+	const unsigned char *in;
+	unsigned char *out;
+	const size_t *offsets;
+	size_t count;
+	size_t chunk; // messages per pool task
+} batch_call;
+
+typedef struct {
+	const cipher_backend *be;
+	const key_schedule *ks1;
+	const key_schedule *ks2;
+	uint64_t first_sector;
+	const unsigned char *in;
+	unsigned char *out;
+	size_t sector_size;
+	size_t sectors;
+	size_t chunk; // sectors per pool task
+	int mode;
+} xts_call;
+
+/**
+ * OFB or CTR keystream made ahead of the data it will be XORed with, into
+ * a ring of capacity bytes. produced and consumed count bytes from the
+ * start of the stream, so produced - consumed is what the ring holds
+**/
+typedef struct {
+	const cipher_backend *be;
+	key_schedule ks;
+	int mode_id;                     // MODE_OFB or MODE_CTR
+	unsigned char chain[STATE_SIZE]; // counter or OFB feedback for the block at produced
+	unsigned char *ring;
+	size_t capacity;                 // whole blocks
+	uint64_t produced;
+	uint64_t consumed;
+	int generating;                  // chain is being advanced outside the lock
+	int background;                  // a producer thread is running
+	int stop;
+	pool_mutex lock;
+	pool_cond changed;
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+} keystream;
+
+/**
+ * Whole mode calls queued for a set of worker threads of their own, for
+ * callers that must not wait on them. Finished jobs collect on a done list
+ * and notify runs, on the worker, each time that list stops being empty
+**/
+typedef struct crypt_job {
+	const cipher_backend *be;
+	const key_schedule *ks;
+	int mode_id;
+	int mode;
+	unsigned char iv[STATE_SIZE];
+	const unsigned char *in;
+	unsigned char *out;
+	size_t len;
+	void *owner; // the submitter's, never touched by the queue
+	struct crypt_job *next;
+} crypt_job;
+
+typedef struct {
+	pool_mutex lock;
+	pool_cond work_ready;
+	crypt_job *queued;
+	crypt_job *queued_tail;
+	crypt_job *done;
+	crypt_job *done_tail;
+	void (*notify)(void *arg);
+	void *notify_arg;
+	int workers;
+	int stop;
+#ifdef _WIN32
+	HANDLE threads[MAX_THREADS];
+#else
+	pthread_t threads[MAX_THREADS];
+#endif
+} job_queue;
+
+// setup, once per process before anything else; init_core() does both and
+// picks the default backend
+void init_tables(void);
+void init_pool(void);
+void init_core(void);
+const cipher_backend* default_backend(void);
+int cpu_count(void);
+
+int rounds_for_key(int key_size);
+int backend_supported(const cipher_backend *be);
+const cipher_backend* find_backend(const char *name);
+int find_mode(const char *name);
+void prepare_decrypt(const cipher_backend *be, key_schedule *ks);
+
+// chaining helpers for callers that feed a mode in pieces
+void add_counter(unsigned char *counter, uint64_t n);
+int mode_splits(int mode_id, int mode);
+int mode_streams(int mode_id);
+void nonce_counter_block(unsigned long long nonce, unsigned char *counter);
+void advance_chain(int mode_id, int mode, unsigned char *chain,
+		const unsigned char *last_in, const unsigned char *last_out, size_t blocks);
+void crypt_tail(const cipher_backend *be, const key_schedule *ks, const unsigned char *chain,
+		const unsigned char *in, unsigned char *out, size_t len);
+
+// whole calls, split across the pool when large enough
+void crypt_mode(const cipher_backend *be, const key_schedule *ks, int mode_id, const unsigned char *iv,
+		const unsigned char *in, unsigned char *out, size_t blocks, int mode);
+void crypt_whole(const cipher_backend *be, const key_schedule *ks, int mode_id,
+		const unsigned char *iv, const unsigned char *in, unsigned char *out, size_t len, int mode);
+void crypt_batch(batch_call *call);
+void xts_crypt(xts_call *call);
+void gcm_crypt(const cipher_backend *be, const key_schedule *ks, const unsigned char *iv,
+		const unsigned char *aad, size_t aad_len, const unsigned char *in, unsigned char *out, size_t len,
+		unsigned char *tag, int mode);
+
+int keystream_init(keystream *kst, const cipher_backend *be, const key_schedule *ks, int mode_id,
+		const unsigned char *iv, size_t lookahead, int background);
+void keystream_fill(keystream *kst);
+void keystream_xor(keystream *kst, const unsigned char *in, unsigned char *out, size_t len);
+size_t keystream_buffered(keystream *kst);
+void keystream_free(keystream *kst);
+
+int job_queue_init(job_queue *q, int workers, void (*notify)(void *arg), void *notify_arg);
+int job_queue_submit(job_queue *q, crypt_job *job);
+crypt_job* job_queue_take_done(job_queue *q);
+void job_queue_stop(job_queue *q);
+crypt_job* job_queue_free(job_queue *q);
+
+int map_file(const char *path, int writable, size_t size, mapped_file *mf);
+void unmap_file(mapped_file *mf);
+
+/**
+ * Opt-in usage counters, off until store_stats_enabled(1). Each call is
+ * recorded once, by backend, mode and direction, with relaxed atomic adds so
+ * they stay cheap with the pool and many threads running at once
+**/
+enum { STAT_GCM = MODE_CTR + 1, STAT_XTS, STAT_MODES }; // the MODE_* values, then gcm and xts
+
+#define STAT_SIZE_BUCKETS 40 // calls by size, bucket n counts [2^n, 2^(n+1)) bytes
+#define STAT_TIME_BUCKETS 40 // calls by latency, bucket n counts [2^n, 2^(n+1)) ns
+
+typedef struct {
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t blocks;
+	uint64_t sizes[STAT_SIZE_BUCKETS];
+	uint64_t latency[STAT_TIME_BUCKETS];
+} op_stats;
+
+int load_stats_enabled(void);
+void store_stats_enabled(int enabled);
+
+const char* stat_mode_name(int stat_mode);
+void schedule_key(const cipher_backend *be, const unsigned char *key, int key_size, key_schedule *ks);
+uint64_t stats_start(void);
+void stats_record(const cipher_backend *be, int stat_mode, int mode, size_t bytes, uint64_t start);
+void stats_read(size_t backend, int stat_mode, int mode, op_stats *out);
+uint64_t stats_key_expansions(size_t backend);
+uint64_t stats_key_inversions(size_t backend);
+void stats_reset(void);
+
+#endif
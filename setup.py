@@ -1,8 +1,32 @@
-from distutils.core import setup, Extension
+from distutils.core import setup, Extension, Command
+from distutils.ccompiler import new_compiler
+from distutils.sysconfig import customize_compiler
+import os
 
-module = Extension('blockcipher', sources = ['blockcipher.c'])
+module = Extension('blockcipher', sources = ['blockcipher.c', 'blockcipher_core.c'],
+	depends = ['blockcipher_core.h', 'bitslice.h'],
+	libraries = ['ws2_32'] if os.name == 'nt' else [])
+
+# builds bccrypt, the command-line tool on the same core, with no Python dependency
+class build_cli(Command):
+	description = 'build the standalone bccrypt executable'
+	user_options = []
+
+	def initialize_options(self):
+		pass
+
+	def finalize_options(self):
+		pass
+
+	def run(self):
+		compiler = new_compiler()
+		customize_compiler(compiler)
+		objects = compiler.compile(['bccrypt.c', 'blockcipher_core.c'], output_dir = os.path.join('build', 'cli'),
+			depends = ['blockcipher_core.h', 'bitslice.h'])
+		compiler.link_executable(objects, 'bccrypt', libraries = [] if os.name == 'nt' else ['pthread'])
 
 setup(name = 'blockcipher',
 	  version = '0.2',
 	  description = 'Package to implement a block cipher',
-	  ext_modules = [module])
\ No newline at end of file
+	  ext_modules = [module],
+	  cmdclass = {'build_cli': build_cli})
\ No newline at end of file